@@ -0,0 +1,136 @@
+#include "auto_flush_writer.h"
+#include "stream_timer.h"
+
+using namespace std;
+
+struct AutoFlushWriterState
+{
+    mutex writeLock; // held while writer is used, taken before lock
+    mutex lock;
+    condition_variable cond;
+    shared_ptr<Writer> writer;
+    StreamClock::duration maxDelay;
+    bool timerPending = false; // if there is a timer for the unflushed bytes
+    uint64_t timerGeneration = 0; // so old timers can tell that they're not needed
+    bool flushRequested = false; // the timer went off so the flusher thread should flush
+    bool done = false;
+    exception_ptr error; // an exception from flushing on the flusher thread
+    thread flusherThread; // flushes for the timer so flushing doesn't hold up the timer thread
+    void flush() // writeLock must be held
+    {
+        {
+            lock_guard<mutex> lockIt(lock);
+            timerPending = false;
+            flushRequested = false;
+        }
+        writer->flush();
+    }
+    void checkError() // lock must be held
+    {
+        if(error)
+        {
+            exception_ptr e = error;
+            error = nullptr;
+            rethrow_exception(e);
+        }
+    }
+    void runFlusher()
+    {
+        unique_lock<mutex> lockIt(lock);
+        while(true)
+        {
+            while(!flushRequested && !done)
+                cond.wait(lockIt);
+            if(done)
+                return;
+            lockIt.unlock();
+            exception_ptr e;
+            try
+            {
+                lock_guard<mutex> lockWrite(writeLock);
+                flush();
+            }
+            catch(...)
+            {
+                e = current_exception();
+            }
+            lockIt.lock();
+            if(e)
+                error = e;
+        }
+    }
+    static void onTimer(shared_ptr<AutoFlushWriterState> state, uint64_t generation)
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        if(!state->timerPending || state->timerGeneration != generation)
+            return;
+        state->flushRequested = true;
+        state->cond.notify_all();
+    }
+};
+
+AutoFlushWriter::AutoFlushWriter(shared_ptr<Writer> writer, StreamClock::duration maxDelay)
+    : state(make_shared<AutoFlushWriterState>())
+{
+    state->writer = writer;
+    state->maxDelay = maxDelay;
+    state->flusherThread = thread(&AutoFlushWriterState::runFlusher, state.get());
+}
+
+AutoFlushWriter::~AutoFlushWriter()
+{
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->done = true;
+        state->cond.notify_all();
+    }
+    state->flusherThread.join();
+    lock_guard<mutex> lockWrite(state->writeLock);
+    bool pending;
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        pending = state->timerPending;
+    }
+    if(!pending)
+        return;
+    try
+    {
+        state->flush(); // any timer that is still scheduled sees that timerPending was reset and does nothing
+    }
+    catch(...)
+    {
+    }
+}
+
+void AutoFlushWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    lock_guard<mutex> lockWrite(state->writeLock);
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->checkError();
+    }
+    if(count == 0)
+        return;
+    state->writer->writeBytes(array, count);
+    lock_guard<mutex> lockIt(state->lock);
+    if(!state->timerPending)
+    {
+        shared_ptr<AutoFlushWriterState> state = this->state;
+        uint64_t generation = ++state->timerGeneration;
+        state->timerPending = true;
+        StreamTimer::get().schedule(StreamClock::now() + state->maxDelay, [state, generation]()
+        {
+            AutoFlushWriterState::onTimer(state, generation);
+        });
+    }
+}
+
+void AutoFlushWriter::flush()
+{
+    lock_guard<mutex> lockWrite(state->writeLock);
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->checkError();
+    }
+    state->flush();
+}
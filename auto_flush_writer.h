@@ -0,0 +1,38 @@
+#ifndef AUTO_FLUSH_WRITER_H_INCLUDED
+#define AUTO_FLUSH_WRITER_H_INCLUDED
+
+#include "stream.h"
+#include <mutex>
+#include <exception>
+
+struct AutoFlushWriterState;
+
+/** a writer that flushes the underlying writer when bytes written to it have waited maxDelay without a flush<br/>
+    put it over a CompressWriter to bound the latency the compression adds :
+    CompressWriter holds input until it has enough to code or until it's flushed,
+    and every flush writes all of it while keeping the window so the next bytes still compress well<br/>
+    the timer wakes a thread of this writer to flush so a slow flush doesn't hold up the shared timer,
+    the underlying writer is only used with a lock held so it's never used by two threads at once,
+    an exception from flushing on that thread is thrown by the next call to writeBytes or flush<br/>
+    the destructor flushes the bytes that haven't been flushed yet
+ */
+class AutoFlushWriter final : public Writer
+{
+private:
+    shared_ptr<AutoFlushWriterState> state;
+public:
+    AutoFlushWriter(shared_ptr<Writer> writer, StreamClock::duration maxDelay = chrono::microseconds(500));
+    AutoFlushWriter(Writer &writer, StreamClock::duration maxDelay = chrono::microseconds(500))
+        : AutoFlushWriter(shared_ptr<Writer>(&writer, [](Writer *) {}), maxDelay)
+    {
+    }
+    virtual ~AutoFlushWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        writeBytes(&v, 1);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override;
+};
+
+#endif // AUTO_FLUSH_WRITER_H_INCLUDED
@@ -0,0 +1,186 @@
+#include "broadcast_stream.h"
+#include <algorithm>
+
+using namespace std;
+
+BroadcastSubscription::BroadcastSubscription(shared_ptr<Writer> sink, BroadcastPolicy policy, size_t maxQueuedChunks)
+    : sink(sink), policy(policy), maxQueuedChunks(max<size_t>(maxQueuedChunks, 1)), connectedInternal(true), droppedChunks(0)
+{
+    writerThread = thread(&BroadcastSubscription::run, this);
+}
+
+BroadcastSubscription::~BroadcastSubscription()
+{
+    close();
+    writerThread.join();
+}
+
+void BroadcastSubscription::run()
+{
+    unique_lock<mutex> lockIt(lock);
+    while(true)
+    {
+        while(queue.empty() && !closed)
+            cond.wait(lockIt);
+        if(queue.empty() || !connectedInternal)
+            return;
+        Chunk chunk = queue.front();
+        queue.pop_front();
+        midUnit = !chunk.endsUnit;
+        bool needFlush = queue.empty();
+        cond.notify_all(); // wake up a blocked producer
+        lockIt.unlock();
+        try
+        {
+            if(chunk.size > 0)
+                sink->writeBytes(chunk.buffer.data(), chunk.size);
+            if(needFlush)
+                sink->flush();
+        }
+        catch(...) // an exception can't leave the thread so any failure disconnects this subscriber
+        {
+            lockIt.lock();
+            error = current_exception();
+            disconnect();
+            return;
+        }
+        lockIt.lock();
+    }
+}
+
+void BroadcastSubscription::disconnect() // lock must be held
+{
+    connectedInternal = false;
+    closed = true;
+    queue.clear();
+    cond.notify_all();
+}
+
+bool BroadcastSubscription::dropOldestUnit() // lock must be held
+{
+    size_t start = 0;
+    if(midUnit) // the rest of the unit that's being written can't be dropped without cutting it
+    {
+        while(start < queue.size() && !queue[start].endsUnit)
+            start++;
+        start++;
+    }
+    size_t end = start;
+    while(end < queue.size() && !queue[end].endsUnit)
+        end++;
+    if(end >= queue.size()) // only the unit that's being written and the unfinished last unit are queued
+        return false;
+    queue.erase(queue.begin() + start, queue.begin() + end + 1);
+    droppedChunks += end + 1 - start;
+    return true;
+}
+
+void BroadcastSubscription::push(Chunk chunk)
+{
+    unique_lock<mutex> lockIt(lock);
+    if(!connectedInternal || closed)
+        return;
+    if(queue.size() >= maxQueuedChunks)
+    {
+        switch(policy)
+        {
+        case BroadcastPolicy::Block:
+            while(queue.size() >= maxQueuedChunks && connectedInternal && !closed)
+                cond.wait(lockIt);
+            if(!connectedInternal || closed)
+                return;
+            break;
+        case BroadcastPolicy::DropOldest:
+            if(!dropOldestUnit())
+            {
+                disconnect();
+                return;
+            }
+            break;
+        case BroadcastPolicy::Disconnect:
+            disconnect();
+            return;
+        }
+    }
+    queue.push_back(chunk);
+    cond.notify_all();
+}
+
+void BroadcastSubscription::close()
+{
+    lock_guard<mutex> lockIt(lock);
+    closed = true;
+    cond.notify_all();
+}
+
+BroadcastWriter::~BroadcastWriter()
+{
+    sendChunk(true);
+    vector<shared_ptr<BroadcastSubscription>> oldSubscriptions;
+    {
+        lock_guard<mutex> lockIt(subscriptionsLock);
+        oldSubscriptions.swap(subscriptions);
+    }
+    for(shared_ptr<BroadcastSubscription> subscription : oldSubscriptions)
+        subscription->close();
+}
+
+shared_ptr<BroadcastSubscription> BroadcastWriter::subscribe(shared_ptr<Writer> sink, BroadcastPolicy policy, size_t maxQueuedChunks)
+{
+    shared_ptr<BroadcastSubscription> retval = make_shared<BroadcastSubscription>(sink, policy, maxQueuedChunks);
+    lock_guard<mutex> lockIt(subscriptionsLock);
+    subscriptions.push_back(retval);
+    return retval;
+}
+
+void BroadcastWriter::unsubscribe(shared_ptr<BroadcastSubscription> subscription)
+{
+    {
+        lock_guard<mutex> lockIt(subscriptionsLock);
+        auto iter = find(subscriptions.begin(), subscriptions.end(), subscription);
+        if(iter == subscriptions.end())
+            return;
+        subscriptions.erase(iter);
+    }
+    subscription->close();
+}
+
+void BroadcastWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(!currentChunk)
+            currentChunk = IOBuffer::allocate();
+        size_t currentCount = min(count, chunkSize - currentChunkSize);
+        memcpy((void *)(currentChunk.data() + currentChunkSize), (const void *)array, currentCount);
+        currentChunkSize += currentCount;
+        array += currentCount;
+        count -= currentCount;
+        if(currentChunkSize >= chunkSize)
+            sendChunk(false);
+    }
+}
+
+void BroadcastWriter::sendChunk(bool endsUnit)
+{
+    if(currentChunkSize == 0 && (!endsUnit || !unitOpen)) // a flush after a full chunk still has to end the unit
+        return;
+    BroadcastSubscription::Chunk chunk;
+    chunk.buffer = std::move(currentChunk);
+    chunk.size = currentChunkSize;
+    chunk.endsUnit = endsUnit;
+    currentChunkSize = 0;
+    unitOpen = !endsUnit;
+    vector<shared_ptr<BroadcastSubscription>> currentSubscriptions;
+    {
+        lock_guard<mutex> lockIt(subscriptionsLock);
+        auto newEnd = remove_if(subscriptions.begin(), subscriptions.end(), [](shared_ptr<BroadcastSubscription> subscription)
+        {
+            return !subscription->connected();
+        });
+        subscriptions.erase(newEnd, subscriptions.end());
+        currentSubscriptions = subscriptions;
+    }
+    for(shared_ptr<BroadcastSubscription> subscription : currentSubscriptions)
+        subscription->push(chunk);
+}
@@ -0,0 +1,110 @@
+#ifndef BROADCAST_STREAM_H_INCLUDED
+#define BROADCAST_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include "buffer_pool.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+enum class BroadcastPolicy
+{
+    Block, // the producer waits for this subscriber when its queue is full
+    DropOldest, // the oldest whole flushed unit is dropped when the queue is full, the subscriber is disconnected if there isn't one
+    Disconnect // the subscriber is disconnected when the queue is full
+};
+
+class BroadcastSubscription final
+{
+    friend class BroadcastWriter;
+    BroadcastSubscription(const BroadcastSubscription &) = delete;
+    const BroadcastSubscription & operator =(const BroadcastSubscription &) = delete;
+private:
+    struct Chunk final
+    {
+        IOBuffer buffer; // shared between the subscriptions and not written to after it's sent
+        size_t size;
+        bool endsUnit; // if this chunk was sent by a flush, the chunks up to it are a unit that can be dropped without cutting a message
+    };
+    const shared_ptr<Writer> sink;
+    const BroadcastPolicy policy;
+    const size_t maxQueuedChunks;
+    mutex lock;
+    condition_variable cond;
+    deque<Chunk> queue;
+    bool closed = false;
+    bool midUnit = false; // if the sink was written some of the unit at the front of queue
+    atomic_bool connectedInternal;
+    atomic<uint64_t> droppedChunks;
+    exception_ptr error; // the exception that disconnected the subscriber, locked by lock
+    thread writerThread;
+    void run();
+    bool dropOldestUnit();
+    void push(Chunk chunk);
+    void close();
+    void disconnect();
+public:
+    BroadcastSubscription(shared_ptr<Writer> sink, BroadcastPolicy policy, size_t maxQueuedChunks);
+    ~BroadcastSubscription();
+    bool connected() const
+    {
+        return connectedInternal;
+    }
+    uint64_t getDroppedChunks() const
+    {
+        return droppedChunks;
+    }
+    /** @return the exception the sink threw that disconnected the subscriber, or null
+     */
+    exception_ptr getError()
+    {
+        lock_guard<mutex> lockIt(lock);
+        return error;
+    }
+};
+
+/** a writer that sends everything written to it to all of its subscribers<br/>
+    the written bytes are shared between subscribers as reference counted pooled chunks and
+    each subscriber is written to from its own thread so a slow subscriber doesn't stall the others<br/>
+    a subscriber that falls behind with BroadcastPolicy::DropOldest misses whole flushed units,
+    so the stream should be flushed at message boundaries for it to stay readable
+ */
+class BroadcastWriter final : public Writer
+{
+private:
+    static constexpr size_t chunkSize = IOBuffer::capacity;
+    IOBuffer currentChunk;
+    size_t currentChunkSize = 0;
+    bool unitOpen = false; // if chunks were sent since the last flush
+    mutex subscriptionsLock;
+    vector<shared_ptr<BroadcastSubscription>> subscriptions;
+    void sendChunk(bool endsUnit);
+public:
+    BroadcastWriter()
+    {
+    }
+    virtual ~BroadcastWriter();
+    shared_ptr<BroadcastSubscription> subscribe(shared_ptr<Writer> sink, BroadcastPolicy policy = BroadcastPolicy::DropOldest, size_t maxQueuedChunks = 64);
+    /** remove subscription after it writes the chunks it has queued
+     */
+    void unsubscribe(shared_ptr<BroadcastSubscription> subscription);
+    virtual void writeByte(uint8_t v) override
+    {
+        if(!currentChunk)
+            currentChunk = IOBuffer::allocate();
+        currentChunk.data()[currentChunkSize++] = v;
+        if(currentChunkSize >= chunkSize)
+            sendChunk(false);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override
+    {
+        sendChunk(true);
+    }
+};
+
+#endif // BROADCAST_STREAM_H_INCLUDED
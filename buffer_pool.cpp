@@ -0,0 +1,158 @@
+#include "buffer_pool.h"
+#include <mutex>
+
+using namespace std;
+
+namespace
+{
+const size_t slabBufferCount = 32;
+const size_t threadCacheSize = 32;
+
+struct SharedPool final
+{
+    mutex lock;
+    IOBufferBlock * freeList = nullptr;
+    atomic<uint64_t> slabAllocations, totalBuffers, buffersInUse, allocations, threadCacheHits;
+    SharedPool()
+        : slabAllocations(0), totalBuffers(0), buffersInUse(0), allocations(0), threadCacheHits(0)
+    {
+    }
+};
+
+SharedPool & getSharedPool()
+{
+    static SharedPool * pool = new SharedPool; // never freed so buffers can be released from any destructor
+    return *pool;
+}
+
+// plain thread locals so they are still usable while other thread locals are being destroyed
+thread_local IOBufferBlock * threadFreeList = nullptr;
+thread_local size_t threadFreeCount = 0;
+thread_local bool threadCacheDone = false;
+
+struct ThreadCacheFlusher final // gives the cached buffers back to the shared pool when the thread exits
+{
+    void use()
+    {
+    }
+    ~ThreadCacheFlusher()
+    {
+        threadCacheDone = true;
+        if(threadFreeList == nullptr)
+            return;
+        IOBufferBlock * last = threadFreeList;
+        while(last->next)
+            last = last->next;
+        SharedPool & pool = getSharedPool();
+        lock_guard<mutex> lockIt(pool.lock);
+        last->next = pool.freeList;
+        pool.freeList = threadFreeList;
+        threadFreeList = nullptr;
+        threadFreeCount = 0;
+    }
+};
+
+thread_local ThreadCacheFlusher threadCacheFlusher;
+}
+
+IOBufferBlock * BufferPool::allocateBlock()
+{
+    SharedPool & pool = getSharedPool();
+    pool.allocations.fetch_add(1, memory_order_relaxed);
+    pool.buffersInUse.fetch_add(1, memory_order_relaxed);
+    if(!threadCacheDone)
+        threadCacheFlusher.use(); // constructs the flusher the first time this thread uses the pool
+    IOBufferBlock * retval = threadFreeList;
+    if(retval)
+    {
+        threadFreeList = retval->next;
+        threadFreeCount--;
+        pool.threadCacheHits.fetch_add(1, memory_order_relaxed);
+    }
+    else
+    {
+        lock_guard<mutex> lockIt(pool.lock);
+        if(pool.freeList == nullptr)
+        {
+            IOBufferBlock * slab = new IOBufferBlock[slabBufferCount];
+            for(size_t i = 0; i < slabBufferCount; i++)
+            {
+                slab[i].next = pool.freeList;
+                pool.freeList = &slab[i];
+            }
+            pool.slabAllocations.fetch_add(1, memory_order_relaxed);
+            pool.totalBuffers.fetch_add(slabBufferCount, memory_order_relaxed);
+        }
+        retval = pool.freeList;
+        pool.freeList = retval->next;
+        if(!threadCacheDone)
+        {
+            for(size_t i = 0; i < threadCacheSize / 2 && pool.freeList != nullptr; i++) // refill the thread cache
+            {
+                IOBufferBlock * block = pool.freeList;
+                pool.freeList = block->next;
+                block->next = threadFreeList;
+                threadFreeList = block;
+                threadFreeCount++;
+            }
+        }
+    }
+    retval->next = nullptr;
+    retval->refCount.store(1, memory_order_relaxed);
+    return retval;
+}
+
+void BufferPool::freeBlock(IOBufferBlock * block)
+{
+    SharedPool & pool = getSharedPool();
+    pool.buffersInUse.fetch_sub(1, memory_order_relaxed);
+    if(!threadCacheDone && threadFreeCount < threadCacheSize)
+    {
+        threadCacheFlusher.use();
+        block->next = threadFreeList;
+        threadFreeList = block;
+        threadFreeCount++;
+        return;
+    }
+    lock_guard<mutex> lockIt(pool.lock);
+    block->next = pool.freeList;
+    pool.freeList = block;
+    if(!threadCacheDone)
+    {
+        while(threadFreeCount > threadCacheSize / 2) // give half of the cache back so other threads can use it
+        {
+            IOBufferBlock * cached = threadFreeList;
+            threadFreeList = cached->next;
+            threadFreeCount--;
+            cached->next = pool.freeList;
+            pool.freeList = cached;
+        }
+    }
+}
+
+void IOBuffer::release(IOBufferBlock * block)
+{
+    BufferPool::freeBlock(block);
+}
+
+BufferPool::Stats BufferPool::getStats()
+{
+    SharedPool & pool = getSharedPool();
+    Stats retval;
+    retval.slabAllocations = pool.slabAllocations.load(memory_order_relaxed);
+    retval.totalBuffers = pool.totalBuffers.load(memory_order_relaxed);
+    retval.buffersInUse = pool.buffersInUse.load(memory_order_relaxed);
+    retval.allocations = pool.allocations.load(memory_order_relaxed);
+    retval.threadCacheHits = pool.threadCacheHits.load(memory_order_relaxed);
+    return retval;
+}
+
+void BufferPool::Stats::writeLine(ostream & os) const
+{
+    os << "buffer-pool-stats slab-allocations=" << slabAllocations;
+    os << " total-buffers=" << totalBuffers;
+    os << " buffers-in-use=" << buffersInUse;
+    os << " allocations=" << allocations;
+    os << " thread-cache-hits=" << threadCacheHits;
+    os << "\n";
+}
@@ -0,0 +1,135 @@
+#ifndef BUFFER_POOL_H_INCLUDED
+#define BUFFER_POOL_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <ostream>
+
+using namespace std;
+
+struct IOBufferBlock;
+
+/** a reference counted fixed size buffer from the process wide buffer pool<br/>
+    buffers are allocated in slabs and recycled through a per thread cache so
+    allocating and freeing buffers doesn't touch the heap once the pool has grown to the working set
+ */
+class IOBuffer final
+{
+public:
+    static constexpr size_t capacity = 8192;
+private:
+    typedef IOBufferBlock Block;
+    friend class BufferPool;
+    Block * block;
+    explicit IOBuffer(Block * block)
+        : block(block)
+    {
+    }
+    static void release(Block * block);
+public:
+    IOBuffer()
+        : block(nullptr)
+    {
+    }
+    IOBuffer(const IOBuffer & rt);
+    IOBuffer(IOBuffer && rt)
+        : block(rt.block)
+    {
+        rt.block = nullptr;
+    }
+    ~IOBuffer()
+    {
+        reset();
+    }
+    const IOBuffer & operator =(const IOBuffer & rt)
+    {
+        IOBuffer(rt).swap(*this);
+        return *this;
+    }
+    const IOBuffer & operator =(IOBuffer && rt)
+    {
+        IOBuffer(std::move(rt)).swap(*this);
+        return *this;
+    }
+    void swap(IOBuffer & rt)
+    {
+        Block * temp = block;
+        block = rt.block;
+        rt.block = temp;
+    }
+    void reset();
+    /** @return a new buffer from the pool
+     */
+    static IOBuffer allocate();
+    explicit operator bool() const
+    {
+        return block != nullptr;
+    }
+    uint8_t * data() const;
+    /** @return true if this is the only reference so it's safe to write to
+     */
+    bool unique() const;
+};
+
+struct IOBufferBlock final
+{
+    uint8_t data[IOBuffer::capacity];
+    atomic_size_t refCount;
+    IOBufferBlock * next;
+};
+
+inline IOBuffer::IOBuffer(const IOBuffer & rt)
+    : block(rt.block)
+{
+    if(block)
+        block->refCount.fetch_add(1, memory_order_relaxed);
+}
+
+inline void IOBuffer::reset()
+{
+    if(block && block->refCount.fetch_sub(1, memory_order_acq_rel) == 1)
+        release(block);
+    block = nullptr;
+}
+
+inline uint8_t * IOBuffer::data() const
+{
+    return block->data;
+}
+
+inline bool IOBuffer::unique() const
+{
+    return block && block->refCount.load(memory_order_acquire) == 1;
+}
+
+/** the process wide pool that IOBuffers come from
+ */
+class BufferPool final
+{
+    friend class IOBuffer;
+    BufferPool() = delete;
+public:
+    struct Stats final
+    {
+        uint64_t slabAllocations = 0; // the only heap allocations the pool does
+        uint64_t totalBuffers = 0;
+        uint64_t buffersInUse = 0;
+        uint64_t allocations = 0;
+        uint64_t threadCacheHits = 0; // allocations that didn't need to lock the shared pool
+        /** write the stats as one line of key=value pairs
+         */
+        void writeLine(ostream & os) const;
+    };
+    static Stats getStats();
+private:
+    static IOBufferBlock * allocateBlock();
+    static void freeBlock(IOBufferBlock * block);
+};
+
+inline IOBuffer IOBuffer::allocate()
+{
+    return IOBuffer(BufferPool::allocateBlock());
+}
+
+#endif // BUFFER_POOL_H_INCLUDED
@@ -0,0 +1,122 @@
+#include "buffered_stream.h"
+#include <algorithm>
+
+using namespace std;
+
+BufferedReader::BufferedReader(shared_ptr<Reader> reader)
+    : reader(reader), buffer(4096)
+{
+}
+
+void BufferedReader::makeRoomAtEnd(size_t count)
+{
+    if(buffer.size() - bufferEnd >= count)
+        return;
+    if(bufferStart > 0)
+    {
+        memmove((void *)&buffer[0], (const void *)&buffer[bufferStart], bufferEnd - bufferStart);
+        bufferEnd -= bufferStart;
+        bufferStart = 0;
+    }
+    if(buffer.size() - bufferEnd < count)
+        buffer.resize(max(buffer.size() * 2, bufferEnd + count));
+}
+
+bool BufferedReader::fill()
+{
+    size_t available;
+    const uint8_t * p = reader->peekBuffered(available);
+    if(available == 0)
+    {
+        uint8_t v;
+        try
+        {
+            v = reader->readByte();
+        }
+        catch(EOFException &)
+        {
+            return false;
+        }
+        makeRoomAtEnd(1);
+        buffer[bufferEnd++] = v;
+        p = reader->peekBuffered(available); // get anything that came in with that byte
+        if(available == 0)
+            return true;
+    }
+    makeRoomAtEnd(available);
+    memcpy((void *)&buffer[bufferEnd], (const void *)p, available);
+    bufferEnd += available;
+    reader->skipBuffered(available);
+    return true;
+}
+
+void BufferedReader::readBytes(uint8_t * array, size_t count)
+{
+    size_t currentCount = min(count, bufferEnd - bufferStart);
+    memcpy((void *)array, (const void *)&buffer[bufferStart], currentCount);
+    bufferStart += currentCount;
+    if(count > currentCount)
+        reader->readBytes(array + currentCount, count - currentCount);
+}
+
+void BufferedReader::unread(const uint8_t * array, size_t count)
+{
+    if(bufferStart < count)
+    {
+        size_t size = bufferEnd - bufferStart;
+        size_t newStart = count;
+        if(buffer.size() < newStart + size)
+            buffer.resize(newStart + size);
+        memmove((void *)&buffer[newStart], (const void *)&buffer[bufferStart], size);
+        bufferStart = newStart;
+        bufferEnd = newStart + size;
+    }
+    bufferStart -= count;
+    memcpy((void *)&buffer[bufferStart], (const void *)array, count);
+}
+
+IOVector BufferedReader::readUntil(uint8_t delim, size_t maxLength)
+{
+    // the delim itself may follow maxLength bytes, so scan one byte more
+    size_t scanLimit = maxLength == (size_t)-1 ? maxLength : maxLength + 1;
+    size_t scanned = 0;
+    while(true)
+    {
+        size_t size = bufferEnd - bufferStart;
+        size_t scanSize = min(size, scanLimit) - min(scanned, min(size, scanLimit));
+        const uint8_t * found = (const uint8_t *)memchr((const void *)&buffer[bufferStart + scanned], delim, scanSize);
+        if(found != nullptr)
+        {
+            size_t length = found - &buffer[bufferStart] + 1;
+            IOVector retval(&buffer[bufferStart], length);
+            bufferStart += length;
+            return retval;
+        }
+        scanned += scanSize;
+        if(scanned >= scanLimit)
+            throw InvalidDataValueException("delimiter not found");
+        if(!fill())
+        {
+            if(bufferStart >= bufferEnd)
+                throw EOFException();
+            IOVector retval(&buffer[bufferStart], bufferEnd - bufferStart);
+            bufferStart = bufferEnd;
+            return retval;
+        }
+    }
+}
+
+string BufferedReader::readLine(size_t maxLength)
+{
+    IOVector line = readUntil('\n', maxLength == (size_t)-1 ? maxLength : maxLength + 1); // leave room for a '\r'
+    size_t size = line.size;
+    if(size > 0 && line.data[size - 1] == '\n')
+    {
+        size--;
+        if(size > 0 && line.data[size - 1] == '\r')
+            size--;
+    }
+    if(size > maxLength)
+        throw InvalidDataValueException("line too long");
+    return string((const char *)line.data, size);
+}
@@ -0,0 +1,95 @@
+#ifndef BUFFERED_STREAM_H_INCLUDED
+#define BUFFERED_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include <vector>
+
+/** a reader with a pushback buffer for delimiter based protocols<br/>
+    it never reads more from the underlying reader than it needs to except for bytes that are already buffered there
+ */
+class BufferedReader final : public Reader
+{
+private:
+    shared_ptr<Reader> reader;
+    vector<uint8_t> buffer;
+    size_t bufferStart = 0, bufferEnd = 0;
+    /** read at least one more byte into the buffer
+        @return false if the underlying reader is at the end
+     */
+    bool fill();
+    void makeRoomAtEnd(size_t count);
+public:
+    explicit BufferedReader(shared_ptr<Reader> reader);
+    explicit BufferedReader(Reader &reader)
+        : BufferedReader(shared_ptr<Reader>(&reader, [](Reader *) {}))
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(bufferStart >= bufferEnd && !fill())
+            throw EOFException();
+        return buffer[bufferStart++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = bufferEnd - bufferStart;
+        if(available == 0)
+            return reader->peekBuffered(available);
+        return &buffer[bufferStart];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        if(bufferStart >= bufferEnd)
+        {
+            reader->skipBuffered(count);
+            return;
+        }
+        assert(count <= bufferEnd - bufferStart);
+        bufferStart += count;
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        reader->setCancellationToken(token);
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        if(bufferStart < bufferEnd)
+        {
+            if(cancellationToken)
+                cancellationToken->check();
+            return true;
+        }
+        return reader->waitReadable(deadline);
+    }
+    /** @return the next byte without reading it
+     */
+    uint8_t peek()
+    {
+        if(bufferStart >= bufferEnd && !fill())
+            throw EOFException();
+        return buffer[bufferStart];
+    }
+    /** put bytes back so they are read next
+     */
+    void unread(const uint8_t * array, size_t count);
+    void unread(uint8_t v)
+    {
+        unread(&v, 1);
+    }
+    /** read up to and including the next delim<br/>
+        the returned bytes stay valid until the next call to this reader<br/>
+        at the end of the stream it returns the bytes before the end without a delim
+        @throws EOFException if there are no bytes left
+        @throws InvalidDataValueException if there are more than maxLength bytes before delim
+     */
+    IOVector readUntil(uint8_t delim, size_t maxLength = (size_t)-1);
+    /** read a line and remove the "\n" or "\r\n" at the end
+        @throws EOFException if there are no bytes left
+        @throws InvalidDataValueException if the line without the "\n" or "\r\n" is longer than maxLength
+     */
+    string readLine(size_t maxLength = (size_t)-1);
+};
+
+#endif // BUFFERED_STREAM_H_INCLUDED
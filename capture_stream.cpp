@@ -0,0 +1,217 @@
+#include "capture_stream.h"
+#include "compressed_stream.h"
+
+using namespace std;
+
+constexpr uint8_t CaptureFormat::magic[4];
+
+CaptureRecorder::CaptureRecorder(shared_ptr<Writer> file, bool compress, size_t maxPendingBytes, StreamClock::duration coalesceInterval)
+    : writer(file), maxPendingBytes(maxPendingBytes), coalesceInterval(coalesceInterval), startTime(StreamClock::now()), droppedBytes(0)
+{
+    file->writeBytes(CaptureFormat::magic, sizeof(CaptureFormat::magic));
+    file->writeU8(CaptureFormat::version);
+    file->writeU8(compress ? CaptureFormat::flagCompressed : 0);
+    file->writeU64((uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    file->flush();
+    if(compress)
+        writer = make_shared<CompressWriter>(file, CompressWriter::defaultLevel, LZ77Format::Entropy);
+    writerThread = thread(&CaptureRecorder::run, this);
+}
+
+CaptureRecorder::~CaptureRecorder()
+{
+    {
+        lock_guard<mutex> lockIt(lock);
+        done = true;
+        cond.notify_all();
+    }
+    writerThread.join();
+}
+
+void CaptureRecorder::record(CaptureKind kind, const uint8_t * array, size_t count)
+{
+    if(count == 0)
+        return;
+    StreamClock::time_point time = StreamClock::now();
+    lock_guard<mutex> lockIt(lock);
+    bool wasEmpty = pendingRecords.empty();
+    if(pendingData.size() + count > maxPendingBytes)
+    {
+        droppedBytes += count;
+        if(!pendingRecords.empty() && pendingRecords.back().kind == CaptureKind::Gap)
+            pendingRecords.back().size += count;
+        else
+            pendingRecords.push_back(Record{CaptureKind::Gap, time, pendingData.size(), count});
+        return;
+    }
+    if(!pendingRecords.empty() && pendingRecords.back().kind == kind && time - pendingRecords.back().time < coalesceInterval)
+        pendingRecords.back().size += count;
+    else
+        pendingRecords.push_back(Record{kind, time, pendingData.size(), count});
+    pendingData.insert(pendingData.end(), array, array + count);
+    if(wasEmpty)
+        cond.notify_all();
+}
+
+void CaptureRecorder::run()
+{
+    vector<Record> records;
+    vector<uint8_t> data;
+    StreamClock::time_point lastTime = startTime;
+    unique_lock<mutex> lockIt(lock);
+    while(true)
+    {
+        while(pendingRecords.empty() && !done)
+            cond.wait(lockIt);
+        if(pendingRecords.empty())
+            break;
+        StreamClock::time_point coalesceEnd = pendingRecords.back().time + coalesceInterval;
+        while(!done && StreamClock::now() < coalesceEnd) // give the last record time to collect more data
+            cond.wait_until(lockIt, coalesceEnd);
+        records.swap(pendingRecords); // swap so the buffers are reused and recording doesn't allocate
+        data.swap(pendingData);
+        lockIt.unlock();
+        try
+        {
+            for(const Record & record : records)
+            {
+                writer->writeU8((uint8_t)record.kind);
+                uint64_t time = 0;
+                if(record.time > lastTime)
+                    time = (uint64_t)chrono::duration_cast<chrono::microseconds>(record.time - lastTime).count();
+                lastTime += chrono::microseconds(time); // keep the rounding error from adding up
+                writer->writeVarU64(time);
+                writer->writeVarU32((uint32_t)record.size);
+                if(record.kind != CaptureKind::Gap)
+                    writer->writeBytes(&data[record.offset], record.size);
+            }
+            writer->flush();
+        }
+        catch(IOException &)
+        {
+            lockIt.lock();
+            for(const Record & record : records)
+                if(record.kind != CaptureKind::Gap)
+                    droppedBytes += record.size;
+            records.clear();
+            data.clear();
+            continue;
+        }
+        records.clear();
+        data.clear();
+        lockIt.lock();
+    }
+}
+
+CaptureFileReader::CaptureFileReader(shared_ptr<Reader> file)
+    : reader(file)
+{
+    uint8_t magic[sizeof(CaptureFormat::magic)];
+    file->readBytes(magic, sizeof(magic));
+    if(0 != memcmp((const void *)magic, (const void *)CaptureFormat::magic, sizeof(magic)))
+        throw InvalidDataValueException("not a capture file");
+    if(file->readU8() != CaptureFormat::version)
+        throw InvalidDataValueException("unsupported capture file version");
+    uint8_t flags = file->readU8();
+    startTime = file->readU64();
+    if(flags & CaptureFormat::flagCompressed)
+        reader = make_shared<ExpandReader>(file);
+}
+
+bool CaptureFileReader::readRecord(CaptureRecord & record)
+{
+    try
+    {
+        uint8_t kind = reader->readU8();
+        if(kind > (uint8_t)CaptureKind::Gap)
+            throw InvalidDataValueException("invalid capture record kind");
+        record.kind = (CaptureKind)kind;
+        time += chrono::microseconds(reader->readVarU64());
+        record.time = time;
+        size_t size = reader->readVarU32();
+        record.data.clear();
+        record.droppedBytes = 0;
+        if(record.kind == CaptureKind::Gap)
+        {
+            record.droppedBytes = size;
+        }
+        else
+        {
+            record.data.resize(size);
+            reader->readBytes(record.data.data(), size);
+        }
+        return true;
+    }
+    catch(EOFException &) // a capture that was cut off ends at the last complete record
+    {
+        record.data.clear();
+        return false;
+    }
+}
+
+bool ReplayReader::nextRecord()
+{
+    recordOffset = 0;
+    recordDue = false;
+    while(file.readRecord(record))
+    {
+        if(record.kind == kind && !record.data.empty())
+            return true;
+    }
+    return false;
+}
+
+void ReplayReader::sleepUntil(StreamClock::time_point time)
+{
+    if(cancellationToken)
+        waitFdReadable(cancellationToken->waitFd(), time, cancellationToken);
+    else if(time != StreamClock::time_point::max())
+        this_thread::sleep_until(time);
+}
+
+bool ReplayReader::waitForRecord(StreamClock::time_point deadline)
+{
+    if(cancellationToken)
+        cancellationToken->check();
+    if(ended || (recordDue && recordOffset < record.data.size()))
+        return true;
+    if(recordDue || record.data.empty())
+    {
+        if(!nextRecord())
+        {
+            ended = true;
+            return true;
+        }
+    }
+    if(!started)
+    {
+        started = true;
+        startTime = StreamClock::now() - record.time;
+    }
+    if(speed == ReplaySpeed::Original)
+    {
+        StreamClock::time_point due = startTime + record.time;
+        if(due > deadline)
+        {
+            sleepUntil(deadline);
+            return false;
+        }
+        sleepUntil(due);
+    }
+    recordDue = true;
+    return true;
+}
+
+void ReplayReader::readBytes(uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(!recordDue || recordOffset >= record.data.size())
+            fillRecord();
+        size_t currentCount = min(count, record.data.size() - recordOffset);
+        memcpy((void *)array, (const void *)&record.data[recordOffset], currentCount);
+        recordOffset += currentCount;
+        array += currentCount;
+        count -= currentCount;
+    }
+}
@@ -0,0 +1,256 @@
+#ifndef CAPTURE_STREAM_H_INCLUDED
+#define CAPTURE_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// capture file format :
+// 4 byte magic number ("SCAP")
+// U8 version
+// U8 flags (CaptureFormat::flagCompressed means the records are compressed with CompressWriter, older captures use the legacy LZ77 format)
+// U64 start time in microseconds since the unix epoch
+// records until the end of the file :
+//   U8 kind (CaptureKind)
+//   VarU64 microseconds since the previous record (or the start time)
+//   VarU32 size
+//   size bytes of data, Gap records don't have any data and size is the number of bytes that were dropped
+
+struct CaptureFormat final
+{
+    static constexpr uint8_t magic[4] = {'S', 'C', 'A', 'P'};
+    static constexpr uint8_t version = 1;
+    static constexpr uint8_t flagCompressed = 0x1;
+};
+
+enum class CaptureKind : uint8_t
+{
+    Read = 0, // bytes read from the captured stream
+    Write = 1, // bytes written to the captured stream
+    Gap = 2 // bytes dropped because the recorder fell behind
+};
+
+/** writes capture records to a capture file from a background thread so recording doesn't block the captured streams<br/>
+    if the file can't keep up more than maxPendingBytes the newest data is dropped and a Gap record is written
+ */
+class CaptureRecorder final
+{
+    CaptureRecorder(const CaptureRecorder &) = delete;
+    const CaptureRecorder & operator =(const CaptureRecorder &) = delete;
+private:
+    struct Record final
+    {
+        CaptureKind kind;
+        StreamClock::time_point time;
+        size_t offset, size;
+    };
+    shared_ptr<Writer> writer;
+    const size_t maxPendingBytes;
+    const StreamClock::duration coalesceInterval;
+    StreamClock::time_point startTime;
+    mutex lock;
+    condition_variable cond;
+    bool done = false;
+    vector<Record> pendingRecords;
+    vector<uint8_t> pendingData;
+    atomic<uint64_t> droppedBytes;
+    thread writerThread;
+    void run();
+public:
+    /** @param compress compress the records with CompressWriter
+        @param coalesceInterval data of the same kind recorded within coalesceInterval of the start of a record is added to that record
+     */
+    CaptureRecorder(shared_ptr<Writer> file, bool compress = false, size_t maxPendingBytes = 1 << 22, StreamClock::duration coalesceInterval = chrono::milliseconds(1));
+    ~CaptureRecorder();
+    void record(CaptureKind kind, const uint8_t * array, size_t count);
+    uint64_t getDroppedBytes() const
+    {
+        return droppedBytes;
+    }
+};
+
+/** reader decorator that records everything read through it
+ */
+class RecordingReader final : public Reader
+{
+private:
+    shared_ptr<Reader> reader;
+    shared_ptr<CaptureRecorder> recorder;
+public:
+    RecordingReader(shared_ptr<Reader> reader, shared_ptr<CaptureRecorder> recorder)
+        : reader(reader), recorder(recorder)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        uint8_t retval = reader->readByte();
+        recorder->record(CaptureKind::Read, &retval, 1);
+        return retval;
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        reader->readBytes(array, count);
+        recorder->record(CaptureKind::Read, array, count);
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        return reader->peekBuffered(available);
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        size_t available;
+        const uint8_t * p = reader->peekBuffered(available);
+        assert(count <= available);
+        recorder->record(CaptureKind::Read, p, count);
+        reader->skipBuffered(count);
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        reader->setCancellationToken(token);
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        return reader->waitReadable(deadline);
+    }
+};
+
+/** writer decorator that records everything written through it
+ */
+class RecordingWriter final : public Writer
+{
+private:
+    shared_ptr<Writer> writer;
+    shared_ptr<CaptureRecorder> recorder;
+public:
+    RecordingWriter(shared_ptr<Writer> writer, shared_ptr<CaptureRecorder> recorder)
+        : writer(writer), recorder(recorder)
+    {
+    }
+    virtual void writeByte(uint8_t v) override
+    {
+        writer->writeByte(v);
+        recorder->record(CaptureKind::Write, &v, 1);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        writer->writeBytes(array, count);
+        recorder->record(CaptureKind::Write, array, count);
+    }
+    virtual void writeVectored(const IOVector * vectors, size_t count) override
+    {
+        writer->writeVectored(vectors, count);
+        for(size_t i = 0; i < count; i++)
+            recorder->record(CaptureKind::Write, vectors[i].data, vectors[i].size);
+    }
+    virtual void flush() override
+    {
+        writer->flush();
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        writer->setCancellationToken(token);
+    }
+    virtual bool waitWritable(StreamClock::time_point deadline) override
+    {
+        return writer->waitWritable(deadline);
+    }
+};
+
+struct CaptureRecord final
+{
+    CaptureKind kind = CaptureKind::Read;
+    StreamClock::duration time = StreamClock::duration::zero(); // since the start of the capture
+    vector<uint8_t> data;
+    size_t droppedBytes = 0; // for Gap records
+};
+
+/** reads the records of a capture file
+ */
+class CaptureFileReader final
+{
+    CaptureFileReader(const CaptureFileReader &) = delete;
+    const CaptureFileReader & operator =(const CaptureFileReader &) = delete;
+private:
+    shared_ptr<Reader> reader;
+    uint64_t startTime;
+    StreamClock::duration time = StreamClock::duration::zero();
+public:
+    /** reads the header
+        @throws InvalidDataValueException if file isn't a capture file
+     */
+    explicit CaptureFileReader(shared_ptr<Reader> file);
+    /** @return the start time in microseconds since the unix epoch
+     */
+    uint64_t getStartTime() const
+    {
+        return startTime;
+    }
+    /** @return false at the end of the capture
+     */
+    bool readRecord(CaptureRecord & record);
+};
+
+enum class ReplaySpeed
+{
+    Original, // bytes become readable at the same time after the first read as they were recorded
+    AsFastAsPossible
+};
+
+/** a reader that replays one kind of record from a capture file
+ */
+class ReplayReader final : public Reader
+{
+private:
+    CaptureFileReader file;
+    const CaptureKind kind;
+    const ReplaySpeed speed;
+    bool started = false, ended = false;
+    StreamClock::time_point startTime;
+    CaptureRecord record;
+    size_t recordOffset = 0;
+    bool recordDue = false; // the current record's time has come so it can be read
+    bool nextRecord();
+    void sleepUntil(StreamClock::time_point time);
+    bool waitForRecord(StreamClock::time_point deadline);
+    void fillRecord()
+    {
+        waitForRecord(StreamClock::time_point::max());
+        if(!recordDue || recordOffset >= record.data.size())
+            throw EOFException();
+    }
+public:
+    ReplayReader(shared_ptr<Reader> file, CaptureKind kind = CaptureKind::Read, ReplaySpeed speed = ReplaySpeed::Original)
+        : file(file), kind(kind), speed(speed)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(!recordDue || recordOffset >= record.data.size())
+            fillRecord();
+        return record.data[recordOffset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = recordDue ? record.data.size() - recordOffset : 0;
+        if(available == 0)
+            return nullptr;
+        return &record.data[recordOffset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= record.data.size() - recordOffset);
+        recordOffset += count;
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        return waitForRecord(deadline);
+    }
+};
+
+#endif // CAPTURE_STREAM_H_INCLUDED
@@ -0,0 +1,153 @@
+#include "coalescing_writer.h"
+#include "stream_timer.h"
+
+using namespace std;
+
+struct CoalescingWriterState
+{
+    mutex writeLock; // held while writing to writer so the buffers are written in order, taken before lock
+    mutex lock;
+    condition_variable cond;
+    shared_ptr<Writer> writer;
+    StreamClock::duration maxDelay;
+    size_t maxBytes;
+    vector<uint8_t> buffer;
+    vector<uint8_t> sending; // the bytes being written, writeLock must be held
+    bool timerPending = false; // if there is a timer for the bytes in buffer
+    uint64_t timerGeneration = 0; // so old timers can tell that they're not needed
+    bool sendRequested = false; // the timer went off so the flusher thread should send buffer
+    bool done = false;
+    exception_ptr error; // an exception from writing on the flusher thread
+    thread flusherThread; // writes for the timer so a slow writer doesn't hold up the timer thread
+    void send() // lock must not be held
+    {
+        lock_guard<mutex> lockWrite(writeLock);
+        {
+            lock_guard<mutex> lockIt(lock);
+            timerPending = false;
+            sendRequested = false;
+            sending.swap(buffer); // sending is empty so buffer keeps its capacity
+        }
+        if(sending.empty())
+            return;
+        try
+        {
+            writer->writeBytes(sending.data(), sending.size());
+            writer->flush();
+        }
+        catch(...)
+        {
+            sending.clear();
+            throw;
+        }
+        sending.clear();
+    }
+    void checkError() // lock must be held
+    {
+        if(error)
+        {
+            exception_ptr e = error;
+            error = nullptr;
+            rethrow_exception(e);
+        }
+    }
+    void runFlusher()
+    {
+        unique_lock<mutex> lockIt(lock);
+        while(true)
+        {
+            while(!sendRequested && !done)
+                cond.wait(lockIt);
+            if(done)
+                return;
+            lockIt.unlock();
+            exception_ptr e;
+            try
+            {
+                send();
+            }
+            catch(...)
+            {
+                e = current_exception();
+            }
+            lockIt.lock();
+            if(e)
+                error = e;
+        }
+    }
+    static void onTimer(shared_ptr<CoalescingWriterState> state, uint64_t generation)
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        if(!state->timerPending || state->timerGeneration != generation)
+            return;
+        state->sendRequested = true;
+        state->cond.notify_all();
+    }
+};
+
+CoalescingWriter::CoalescingWriter(shared_ptr<Writer> writer, StreamClock::duration maxDelay, size_t maxBytes)
+    : state(make_shared<CoalescingWriterState>())
+{
+    state->writer = writer;
+    state->maxDelay = maxDelay;
+    state->maxBytes = max<size_t>(maxBytes, 1);
+    state->buffer.reserve(state->maxBytes);
+    state->sending.reserve(state->maxBytes);
+    state->flusherThread = thread(&CoalescingWriterState::runFlusher, state.get());
+}
+
+CoalescingWriter::~CoalescingWriter()
+{
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->done = true;
+        state->cond.notify_all();
+    }
+    state->flusherThread.join();
+    try
+    {
+        state->send(); // any timer that is still scheduled sees that timerPending was reset and does nothing
+    }
+    catch(...)
+    {
+    }
+}
+
+void CoalescingWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->checkError();
+        if(count == 0)
+            return;
+        if(state->buffer.empty())
+        {
+            shared_ptr<CoalescingWriterState> state = this->state;
+            uint64_t generation = ++state->timerGeneration;
+            state->timerPending = true;
+            StreamTimer::get().schedule(StreamClock::now() + state->maxDelay, [state, generation]()
+            {
+                CoalescingWriterState::onTimer(state, generation);
+            });
+        }
+        state->buffer.insert(state->buffer.end(), array, array + count);
+        if(state->buffer.size() < state->maxBytes)
+            return;
+    }
+    state->send();
+}
+
+void CoalescingWriter::flush()
+{
+    lock_guard<mutex> lockIt(state->lock);
+    state->checkError();
+}
+
+void CoalescingWriter::flushNow()
+{
+    {
+        lock_guard<mutex> lockIt(state->lock);
+        state->checkError();
+    }
+    state->send();
+}
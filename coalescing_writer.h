@@ -0,0 +1,38 @@
+#ifndef COALESCING_WRITER_H_INCLUDED
+#define COALESCING_WRITER_H_INCLUDED
+
+#include "stream.h"
+#include <vector>
+#include <mutex>
+#include <exception>
+
+struct CoalescingWriterState;
+
+/** a writer that collects small writes and flushes into bigger ones<br/>
+    the buffered bytes are written and flushed to the underlying writer when there are maxBytes of them
+    or when the oldest has waited for maxDelay, whichever comes first<br/>
+    flush doesn't write anything by itself, use flushNow to write immediately<br/>
+    the bytes that wait for maxDelay are written by a thread of this writer so a slow underlying writer doesn't hold up the shared timer,
+    an exception from writing them is thrown by the next call to writeBytes, flush or flushNow
+ */
+class CoalescingWriter final : public Writer
+{
+private:
+    shared_ptr<CoalescingWriterState> state;
+public:
+    CoalescingWriter(shared_ptr<Writer> writer, StreamClock::duration maxDelay = chrono::milliseconds(2), size_t maxBytes = 1400);
+    CoalescingWriter(Writer &writer, StreamClock::duration maxDelay = chrono::milliseconds(2), size_t maxBytes = 1400)
+        : CoalescingWriter(shared_ptr<Writer>(&writer, [](Writer *) {}), maxDelay, maxBytes)
+    {
+    }
+    virtual ~CoalescingWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        writeBytes(&v, 1);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override;
+    void flushNow();
+};
+
+#endif // COALESCING_WRITER_H_INCLUDED
@@ -1,8 +1,468 @@
 #include "compressed_stream.h"
+#include "entropy_coder.h"
 #include "util.h"
 #include <iostream>
 #include <cstdlib>
 #include <thread>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+size_t hash3(const uint8_t * p, int hashBits)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761U) >> (32 - hashBits);
+}
+
+size_t hash2(const uint8_t * p, int hashBits)
+{
+    uint32_t v = ((uint32_t)p[0] << 8) | p[1];
+    return (v * 2654435761U) >> (32 - hashBits);
+}
+
+// the match length kernels compare whole words and find the first different byte from the lowest set bit of the xor,
+// the last word is compared ending at maxLength so they never read past the bytes being compared
+
+size_t matchLengthBytes(const uint8_t * a, const uint8_t * b, size_t maxLength)
+{
+    size_t length = 0;
+    while(length < maxLength && a[length] == b[length])
+        length++;
+    return length;
+}
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+uint64_t load64(const uint8_t * p)
+{
+    uint64_t retval;
+    memcpy((void *)&retval, (const void *)p, sizeof(retval));
+    return retval;
+}
+
+size_t matchLengthWords(const uint8_t * a, const uint8_t * b, size_t maxLength)
+{
+    if(maxLength < 8)
+        return matchLengthBytes(a, b, maxLength);
+    for(size_t length = 0; length + 8 < maxLength; length += 8)
+    {
+        uint64_t difference = load64(a + length) ^ load64(b + length);
+        if(difference != 0)
+            return length + (__builtin_ctzll(difference) >> 3);
+    }
+    uint64_t difference = load64(a + maxLength - 8) ^ load64(b + maxLength - 8);
+    return difference != 0 ? maxLength - 8 + (__builtin_ctzll(difference) >> 3) : maxLength;
+}
+#else
+size_t matchLengthWords(const uint8_t * a, const uint8_t * b, size_t maxLength)
+{
+    return matchLengthBytes(a, b, maxLength);
+}
+#endif
+
+#ifdef __SSE2__
+size_t matchLengthSSE2(const uint8_t * a, const uint8_t * b, size_t maxLength)
+{
+    if(maxLength < 16)
+        return matchLengthWords(a, b, maxLength);
+    for(size_t length = 0; length + 16 < maxLength; length += 16)
+    {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + length)), _mm_loadu_si128((const __m128i *)(b + length)));
+        uint32_t difference = ~(uint32_t)_mm_movemask_epi8(equal) & 0xFFFF;
+        if(difference != 0)
+            return length + __builtin_ctz(difference);
+    }
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + maxLength - 16)), _mm_loadu_si128((const __m128i *)(b + maxLength - 16)));
+    uint32_t difference = ~(uint32_t)_mm_movemask_epi8(equal) & 0xFFFF;
+    return difference != 0 ? maxLength - 16 + __builtin_ctz(difference) : maxLength;
+}
+#endif
+}
+
+constexpr uint8_t LZ77GeometryFormat::magic[3];
+
+template <typename Geometry>
+typename BasicCompressWriter<Geometry>::LevelParameters BasicCompressWriter<Geometry>::getLevelParameters(int level)
+{
+    static const LevelParameters levels[maxLevel - minLevel + 1] =
+    {
+        {1, Parser::Greedy},
+        {4, Parser::Greedy},
+        {8, Parser::Greedy},
+        {16, Parser::Lazy},
+        {32, Parser::Lazy},
+        {128, Parser::Lazy},
+        {64, Parser::Optimal},
+        {256, Parser::Optimal},
+        {1024, Parser::Optimal},
+    };
+    return levels[limit(level, minLevel, maxLevel) - minLevel];
+}
+
+template <typename Geometry>
+BasicCompressWriter<Geometry>::BasicCompressWriter(shared_ptr<Writer> writer, int level, LZ77Format format, const vector<uint8_t> & dictionary)
+    : writer(writer), parameters(getLevelParameters(level)),
+      lookaheadSize(parameters.parser == Parser::Optimal ? optimalLookaheadSize : 2 * maxCodeLength),
+      data(dataSize), head3(hashSize, 0), chain3(windowSize, 0), last2(hashSize, 0)
+{
+    if(format == LZ77Format::Entropy)
+        entropyEncoder = make_shared<LZ77EntropyEncoder>(Geometry::maxLength, Geometry::offsetBits);
+    for(uint32_t & v : last1)
+        v = 0;
+    if(parameters.parser == Parser::Optimal)
+        parseSteps.resize(lookaheadSize);
+    size_t size = dictionary.size() < windowSize ? dictionary.size() : windowSize; // the dictionary is hashed with the input when it's searched
+    if(size != 0)
+        memcpy((void *)&data[0], (const void *)&dictionary[dictionary.size() - size], size);
+    inputStart = inputEnd = size;
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::slideData()
+{
+    size_t keep = inputStart < windowSize ? inputStart : windowSize;
+    size_t shift = inputStart - keep;
+    if(shift == 0)
+        return;
+    memmove((void *)&data[0], (const void *)&data[shift], inputEnd - shift);
+    dataStart += shift;
+    inputStart -= shift;
+    inputEnd -= shift;
+    hashedEnd = hashedEnd > shift ? hashedEnd - shift : 0;
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::hashUpTo(size_t end)
+{
+    for(; hashedEnd < end; hashedEnd++)
+    {
+        uint32_t position = dataStart + (uint32_t)hashedEnd;
+        const uint8_t * p = &data[hashedEnd];
+        last1[p[0]] = position;
+        if(hashedEnd + 2 > inputEnd)
+            continue;
+        last2[hash2(p, hashBits)] = position;
+        if(hashedEnd + 3 > inputEnd)
+            continue;
+        size_t h = hash3(p, hashBits);
+        chain3[position % windowSize] = head3[h];
+        head3[h] = position;
+    }
+}
+
+template <typename Geometry>
+size_t BasicCompressWriter<Geometry>::matchLength(size_t index, size_t distance, size_t maxLength) const
+{
+    const uint8_t * a = &data[index - distance];
+    const uint8_t * b = &data[index];
+#ifdef __SSE2__ // every x86-64 processor has SSE2 so it doesn't need to be checked when running
+    return matchLengthSSE2(a, b, maxLength);
+#else
+    return matchLengthWords(a, b, maxLength);
+#endif
+}
+
+template <typename Geometry>
+typename BasicCompressWriter<Geometry>::Match BasicCompressWriter<Geometry>::findMatch(size_t index) const
+{
+    Match retval;
+    size_t maxCopy = maxCopyAt(index);
+    if(maxCopy == 0)
+        return retval;
+    uint32_t position = dataStart + (uint32_t)index;
+    size_t maxDistance = index < windowSize ? index : windowSize;
+    if(maxCopy >= 3)
+    {
+        uint32_t candidate = head3[hash3(&data[index], hashBits)];
+        size_t lastDistance = 0;
+        for(size_t depth = 0; depth < parameters.chainDepth; depth++)
+        {
+            size_t distance = (uint32_t)(position - candidate);
+            if(distance <= lastDistance || distance > maxDistance) // the chain went out of the window
+                break;
+            lastDistance = distance;
+            size_t length = matchLength(index, distance, maxCopy);
+            if(length > retval.copyLength)
+            {
+                retval.copyLength = length;
+                retval.distance = distance;
+                if(length >= maxCopy)
+                    return retval;
+            }
+            candidate = chain3[candidate % windowSize];
+        }
+        if(retval.copyLength >= 3)
+            return retval;
+    }
+    if(maxCopy >= 2)
+    {
+        size_t distance = (uint32_t)(position - last2[hash2(&data[index], hashBits)]);
+        if(distance != 0 && distance <= maxDistance && matchLength(index, distance, 2) == 2)
+        {
+            retval.copyLength = 2;
+            retval.distance = distance;
+            return retval;
+        }
+    }
+    if(retval.copyLength == 0)
+    {
+        size_t distance = (uint32_t)(position - last1[data[index]]);
+        if(distance != 0 && distance <= maxDistance && data[index - distance] == data[index])
+        {
+            retval.copyLength = 1;
+            retval.distance = distance;
+        }
+    }
+    return retval;
+}
+
+template <typename Geometry>
+typename BasicCompressWriter<Geometry>::Match BasicCompressWriter<Geometry>::findCodeMatch(size_t index)
+{
+    if(haveLazyMatch && lazyPosition == dataStart + (uint32_t)index)
+    {
+        haveLazyMatch = false;
+        return lazyMatch;
+    }
+    haveLazyMatch = false;
+    hashUpTo(index);
+    return findMatch(index);
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::writeCode(size_t index, size_t copyLength, size_t distance)
+{
+    if(!wroteCode)
+    {
+        wroteCode = true;
+        if(!Geometry::legacy)
+        {
+            writer->writeBytes(LZ77GeometryFormat::magic, sizeof(LZ77GeometryFormat::magic));
+            writer->writeU8((uint8_t)Geometry::lengthBits);
+            writer->writeU8((uint8_t)Geometry::offsetBits);
+        }
+        if(!entropyEncoder && copyLength != 0) // with a dictionary the first code could look like a magic number
+        {
+            uint8_t encoded[Geometry::encodedSize];
+            Geometry::encode(encoded, LZ77CodeType(copyLength, distance - 1, data[index + copyLength]));
+            if(0 == memcmp((const void *)encoded, (const void *)LZ77EntropyFormat::magic, sizeof(LZ77EntropyFormat::magic))
+                    || 0 == memcmp((const void *)encoded, (const void *)LZ77GeometryFormat::magic, sizeof(LZ77GeometryFormat::magic)))
+                copyLength = 0;
+        }
+    }
+    LZ77CodeType code(data[index]);
+    if(copyLength != 0)
+        code = LZ77CodeType(copyLength, distance - 1, data[index + copyLength]);
+    inputStart = index + copyLength + 1;
+    if(!entropyEncoder)
+    {
+        Geometry::write(*writer, code);
+        return;
+    }
+    entropyEncoder->addCode(code);
+    if(entropyEncoder->full())
+        entropyEncoder->writeBlock(*writer);
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::writeGreedyCode()
+{
+    size_t index = inputStart;
+    Match match = findCodeMatch(index);
+    if(parameters.parser == Parser::Lazy && match.copyLength > 0 && match.copyLength < maxCopyLength && index + 1 < inputEnd)
+    {
+        hashUpTo(index + 1);
+        lazyMatch = findMatch(index + 1);
+        lazyPosition = dataStart + (uint32_t)(index + 1);
+        haveLazyMatch = true;
+        if(lazyMatch.copyLength > 2 * match.copyLength) // a literal and the longer match cover more than this match and a similar one after it
+        {
+            writeCode(index, 0, 0);
+            return;
+        }
+    }
+    writeCode(index, match.copyLength, match.distance);
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::writeOptimalCodes(bool all)
+{
+    size_t parseEnd = inputEnd;
+    if(!all)
+    {
+        if(inputEnd - inputStart <= maxCodeLength)
+            return;
+        parseEnd -= maxCodeLength; // the positions after this haven't seen all the input their matches could use
+    }
+    size_t count = parseEnd - inputStart;
+    if(parseSteps.size() < count)
+        parseSteps.resize(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        hashUpTo(inputStart + i);
+        parseSteps[i].match = findMatch(inputStart + i);
+    }
+    // legacy codes are all the same size so the best parse is the one with the fewest codes,
+    // entropy coded codes are priced with the bits they take with the encoder's current tables,
+    // codes that go past parseEnd are counted as finishing the input
+    const LZ77EntropyEncoder * encoder = entropyEncoder.get();
+    auto codeCost = [this, encoder](size_t index, size_t copyLength) -> size_t // without the offset
+    {
+        if(encoder == nullptr)
+            return 1;
+        return encoder->lengthCost(copyLength) + encoder->literalCost(data[index + copyLength]);
+    };
+    for(size_t i = count; i-- > 0;)
+    {
+        ParseStep & step = parseSteps[i];
+        size_t index = inputStart + i;
+        step.copyLength = 0;
+        step.cost = codeCost(index, 0) + (i + 1 < count ? parseSteps[i + 1].cost : 0);
+        size_t offsetCost = encoder != nullptr && step.match.copyLength != 0 ? encoder->offsetCost(step.match.distance - 1) : 0;
+        for(size_t copyLength = 1; copyLength <= step.match.copyLength; copyLength++)
+        {
+            size_t next = i + copyLength + 1;
+            size_t cost = codeCost(index, copyLength) + offsetCost + (next < count ? parseSteps[next].cost : 0);
+            if(cost <= step.cost)
+            {
+                step.cost = cost;
+                step.copyLength = copyLength;
+            }
+        }
+    }
+    size_t start = inputStart;
+    while(inputStart < parseEnd)
+    {
+        const ParseStep & step = parseSteps[inputStart - start];
+        writeCode(inputStart, step.copyLength, step.match.distance);
+    }
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::writeCodes(bool all)
+{
+    if(parameters.parser == Parser::Optimal)
+    {
+        writeOptimalCodes(all);
+        return;
+    }
+    if(all)
+    {
+        while(inputStart < inputEnd)
+            writeGreedyCode();
+        return;
+    }
+    while(inputEnd - inputStart > maxCodeLength + 1) // enough input for the longest match at this position and the next
+        writeGreedyCode();
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::flush()
+{
+    writeCodes(true);
+    if(entropyEncoder)
+        entropyEncoder->writeBlock(*writer);
+    writer->flush();
+}
+
+template <typename Geometry>
+void BasicCompressWriter<Geometry>::writeBytes(const uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(inputEnd >= dataSize)
+            slideData();
+        size_t currentCount = min(dataSize - inputEnd, lookaheadSize - (inputEnd - inputStart));
+        if(currentCount > count)
+            currentCount = count;
+        memcpy((void *)&data[inputEnd], (const void *)array, currentCount);
+        inputEnd += currentCount;
+        array += currentCount;
+        count -= currentCount;
+        if(inputEnd - inputStart >= lookaheadSize)
+            writeCodes(false);
+    }
+}
+
+template <typename Geometry>
+void BasicExpandReader<Geometry>::detectFormat()
+{
+    static_assert(sizeof(LZ77EntropyFormat::magic) == sizeof(LZ77GeometryFormat::magic), "the magic numbers must be the same size");
+    static_assert(sizeof(LZ77EntropyFormat::magic) <= Geometry::encodedSize, "the magic numbers must fit in the first code");
+    uint8_t start[Geometry::encodedSize];
+    start[0] = reader->readByte();
+    try
+    {
+        reader->readBytes(&start[1], sizeof(LZ77EntropyFormat::magic) - 1);
+        if(!readGeometryHeader && 0 == memcmp((const void *)start, (const void *)LZ77GeometryFormat::magic, sizeof(LZ77GeometryFormat::magic)))
+        {
+            readGeometryHeader = true;
+            if(reader->readU8() != Geometry::lengthBits || reader->readU8() != Geometry::offsetBits)
+                throw LZ77FormatException();
+            detectFormat();
+            return;
+        }
+        if(0 == memcmp((const void *)start, (const void *)LZ77EntropyFormat::magic, sizeof(LZ77EntropyFormat::magic)))
+        {
+            if(reader->readU8() != LZ77EntropyFormat::version)
+                throw LZ77FormatException();
+            formatDetected = true;
+            entropyDecoder = make_shared<LZ77EntropyDecoder>(Geometry::maxLength, Geometry::offsetBits);
+            return;
+        }
+        reader->readBytes(&start[sizeof(LZ77EntropyFormat::magic)], sizeof(start) - sizeof(LZ77EntropyFormat::magic));
+    }
+    catch(EOFException &)
+    {
+        throw LZ77FormatException();
+    }
+    formatDetected = true;
+    LZ77CodeType code = Geometry::decode(start);
+    if(!validCode(code))
+        throw LZ77FormatException();
+    decodeCode(code);
+}
+
+template <typename Geometry>
+void BasicExpandReader<Geometry>::fillEntropy()
+{
+    while(readIndex >= decodedEnd)
+    {
+        if(blockCodeIndex >= blockCodes.size())
+        {
+            blockCodeIndex = 0;
+            if(!entropyDecoder->readBlock(*reader, blockCodes))
+            {
+                blockCodes.clear();
+                throw EOFException();
+            }
+            continue;
+        }
+        if(decodedEnd + maxCodeLength > dataSize)
+            slideData();
+        while(blockCodeIndex < blockCodes.size() && decodedEnd + maxCodeLength <= dataSize)
+        {
+            const LZ77CodeType & code = blockCodes[blockCodeIndex];
+            if(!validCode(code))
+            {
+                if(readIndex < decodedEnd) // let the bytes before it be read first
+                    return;
+                throw LZ77FormatException();
+            }
+            decodeCode(code);
+            blockCodeIndex++;
+        }
+    }
+}
+
+template class BasicExpandReader<LZ77LegacyGeometry>;
+template class BasicCompressWriter<LZ77LegacyGeometry>;
+template class BasicExpandReader<LZ77WideGeometry>;
+template class BasicCompressWriter<LZ77WideGeometry>;
 
 #if 0 // use demo code
 namespace
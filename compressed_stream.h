@@ -3,6 +3,7 @@
 
 #include <deque>
 #include "stream.h"
+#include "serialization.h"
 #include <iostream>
 
 class LZ77FormatException final : public IOException
@@ -16,8 +17,6 @@ public:
 
 struct LZ77CodeType final
 {
-    static constexpr int lengthBits = 6, offsetBits = 16 - lengthBits;
-    static constexpr size_t maxLength = (1 << lengthBits) - 1, maxOffset = (1 << offsetBits) - 1;
     size_t length;
     size_t offset;
     uint8_t nextByte;
@@ -41,248 +40,375 @@ struct LZ77CodeType final
     {
         return length == 0 && offset != 0;
     }
+};
+
+/** the sizes of the fields of an LZ77 code : a code copies up to maxLength bytes from up to windowSize bytes back<br/>
+    a code in the legacy format is a U8 next byte followed by length << offsetBits | offset as a big endian (lengthBits + offsetBits) / 8 byte number
+ */
+template <int lengthBits_, int offsetBits_>
+struct LZ77Geometry final
+{
+    static_assert((lengthBits_ + offsetBits_) % 8 == 0, "a code must be a whole number of bytes");
+    static_assert(lengthBits_ >= 2 && lengthBits_ <= 10 && offsetBits_ >= 8 && offsetBits_ <= 16, "the entropy coder can't code this geometry");
+    static constexpr int lengthBits = lengthBits_, offsetBits = offsetBits_;
+    static constexpr size_t maxLength = ((size_t)1 << lengthBits) - 1, maxOffset = ((size_t)1 << offsetBits) - 1;
+    static constexpr size_t windowSize = maxOffset + 1;
+    static constexpr size_t encodedSize = 1 + (lengthBits + offsetBits) / 8;
+    static constexpr bool legacy = lengthBits == 6 && offsetBits == 10; // streams with the original geometry don't have a geometry header so every reader can read them
+    /** encode a code as encodedSize bytes at p
+     */
+    static void encode(uint8_t * p, const LZ77CodeType & code)
+    {
+        uint32_t v = (uint32_t)((code.offset & maxOffset) | (code.length << offsetBits));
+        p[0] = code.nextByte;
+        for(size_t i = encodedSize - 1; i > 0; i--, v >>= 8)
+            p[i] = (uint8_t)v;
+    }
+    /** decode a code from encodedSize bytes at p
+     */
+    static LZ77CodeType decode(const uint8_t * p)
+    {
+        uint32_t v = 0;
+        for(size_t i = 1; i < encodedSize; i++)
+            v = (v << 8) | p[i];
+        return LZ77CodeType(v >> offsetBits, v & maxOffset, p[0]);
+    }
     static LZ77CodeType read(Reader &reader)
     {
-        LZ77CodeType retval;
-        retval.nextByte = reader.readByte();
-
+        size_t available;
+        const uint8_t * p = reader.peekBuffered(available);
+        if(available >= encodedSize)
+        {
+            LZ77CodeType retval = decode(p);
+            reader.skipBuffered(encodedSize);
+            return retval;
+        }
+        uint8_t bytes[encodedSize];
+        bytes[0] = reader.readByte();
         try
         {
-            uint16_t v = reader.readU16();
-            retval.length = v >> offsetBits;
-            retval.offset = v & maxOffset;
+            reader.readBytes(&bytes[1], encodedSize - 1);
         }
         catch(EOFException &e)
         {
             throw LZ77FormatException();
         }
-
-        return retval;
+        return decode(bytes);
     }
-    void write(Writer &writer)
+    static void write(Writer &writer, const LZ77CodeType & code)
     {
-        //cout << "Write code : 0x" << hex << (unsigned)nextByte << dec << " : length : " << length << " : offset : " << offset << endl;
-        writer.writeByte(nextByte);
-        uint16_t v = (offset & maxOffset) | (length << offsetBits);
-        writer.writeU16(v);
+        uint8_t bytes[encodedSize];
+        encode(bytes, code);
+        writer.writeBytes(bytes, encodedSize);
     }
 };
 
-class ExpandReader final : public Reader
+template <int lengthBits_, int offsetBits_>
+constexpr int LZ77Geometry<lengthBits_, offsetBits_>::lengthBits;
+template <int lengthBits_, int offsetBits_>
+constexpr int LZ77Geometry<lengthBits_, offsetBits_>::offsetBits;
+template <int lengthBits_, int offsetBits_>
+constexpr size_t LZ77Geometry<lengthBits_, offsetBits_>::maxLength;
+template <int lengthBits_, int offsetBits_>
+constexpr size_t LZ77Geometry<lengthBits_, offsetBits_>::maxOffset;
+template <int lengthBits_, int offsetBits_>
+constexpr size_t LZ77Geometry<lengthBits_, offsetBits_>::windowSize;
+template <int lengthBits_, int offsetBits_>
+constexpr size_t LZ77Geometry<lengthBits_, offsetBits_>::encodedSize;
+
+typedef LZ77Geometry<6, 10> LZ77LegacyGeometry; // 63 byte copies from a 1 KiB window in 3 byte codes
+typedef LZ77Geometry<8, 16> LZ77WideGeometry; // 255 byte copies from a 64 KiB window in 4 byte codes, for long repetitive streams
+
+// the geometry header that starts a stream with a geometry other than LZ77LegacyGeometry :
+// 3 byte magic number ("LZG"), a legacy stream can't start with it because its first code would copy from before the start
+// U8 lengthBits
+// U8 offsetBits
+// then the stream in either format
+
+struct LZ77GeometryFormat final
+{
+    static constexpr uint8_t magic[3] = {'L', 'Z', 'G'};
+};
+
+enum class LZ77Format
+{
+    Legacy, // LZ77CodeType codes, readable by every version
+    Entropy // huffman coded codes (entropy_coder.h), much smaller but only readable by readers that know the format
+};
+
+class LZ77EntropyEncoder;
+class LZ77EntropyDecoder;
+
+/** the most bytes of a preset dictionary that can be used with LZ77LegacyGeometry, only the end of a longer dictionary is used<br/>
+    a preset dictionary is put in the window before the first code so the first bytes of a stream can copy from it,
+    CompressWriter and ExpandReader must be given the same dictionary
+ */
+constexpr size_t maxLZ77DictionarySize = LZ77LegacyGeometry::windowSize;
+
+/** reads both LZ77 formats, the format is detected from the start of the stream<br/>
+    the geometry must be the one the stream was written with
+    @throws LZ77FormatException if the stream has a geometry header for a different geometry
+ */
+template <typename Geometry>
+class BasicExpandReader final : public Reader
 {
+public:
+    static constexpr size_t maxDictionarySize = Geometry::windowSize;
 private:
+    static constexpr size_t windowSize = Geometry::windowSize;
+    static constexpr size_t maxCodeLength = Geometry::maxLength + 1;
+    static constexpr size_t dataSize = 8 * windowSize;
     shared_ptr<Reader> reader;
-    static constexpr size_t bufferSize = LZ77CodeType::maxOffset + 1;
-    circularDeque<uint8_t, bufferSize + 2> buffer;
-    LZ77CodeType currentCode;
-public:
-    ExpandReader(shared_ptr<Reader> reader)
-        : reader(reader)
+    vector<uint8_t> data; // dataSize decoded bytes : the window and then the bytes that haven't been read yet, not a member array so wide readers fit on the stack
+    size_t readIndex = 0, decodedEnd = 0;
+    uint64_t totalDecoded = 0;
+    bool formatDetected = false, readGeometryHeader = false;
+    shared_ptr<LZ77EntropyDecoder> entropyDecoder; // null for the legacy format
+    vector<LZ77CodeType> blockCodes; // the codes of the current entropy coded block
+    size_t blockCodeIndex = 0;
+
+    void slideData()
     {
+        size_t keep = decodedEnd - readIndex;
+        if(keep < windowSize)
+            keep = decodedEnd < windowSize ? decodedEnd : windowSize;
+        size_t shift = decodedEnd - keep;
+        if(shift == 0)
+            return;
+        memmove((void *)&data[0], (const void *)&data[shift], keep);
+        readIndex -= shift;
+        decodedEnd -= shift;
     }
-    ExpandReader(Reader &reader)
-        : ExpandReader(shared_ptr<Reader>(&reader, [](Reader *) {}))
+    bool validCode(const LZ77CodeType & code) const
     {
+        return code.length == 0 || code.offset < totalDecoded;
     }
-    virtual ~ExpandReader()
+    void decodeCode(const LZ77CodeType & code) // there must be room for maxCodeLength bytes
     {
-    }
-    virtual uint8_t readByte() override
-    {
-        while(currentCode.eof())
-        {
-            currentCode = LZ77CodeType::read(*reader);
-        }
-
-        uint8_t retval;
-
-        if(currentCode.length == 0)
-        {
-            retval = currentCode.nextByte;
-            currentCode = LZ77CodeType();
-        }
-        else
+        if(code.length == 0 && code.offset != 0) // EOF
+            return;
+        uint8_t * dest = &data[decodedEnd];
+        if(code.length != 0)
         {
-            if(currentCode.offset >= buffer.size())
+            size_t distance = code.offset + 1;
+            const uint8_t * src = dest - distance;
+            if(distance >= code.length)
             {
-                throw LZ77FormatException();
+                memcpy((void *)dest, (const void *)src, code.length);
             }
-
-            retval = buffer.cbegin()[currentCode.offset];
-
-            if(--currentCode.length == 0)
+            else
             {
-                currentCode = LZ77CodeType(currentCode.nextByte);
+                for(size_t i = 0; i < code.length; i++) // overlapping copy repeats the last distance bytes
+                    dest[i] = src[i];
             }
         }
-
-        buffer.push_front(retval);
-
-        if(buffer.size() > bufferSize)
-        {
-            buffer.pop_back();
-        }
-
-        return retval;
+        dest[code.length] = code.nextByte;
+        decodedEnd += code.length + 1;
+        totalDecoded += code.length + 1;
     }
-};
-
-class CompressWriter final : public Writer
-{
-private:
-    static constexpr int uint8_max = (1 << 8) - 1;
-    static constexpr size_t bufferSize = LZ77CodeType::maxOffset + 1;
-    struct Match
+    void detectFormat();
+    void fillEntropy();
+    void fill()
     {
-        size_t location, length;
-        Match(size_t location, size_t length)
-            : location(location), length(length)
+        if(!formatDetected)
+            detectFormat();
+        if(entropyDecoder)
         {
+            fillEntropy();
+            return;
         }
-        Match()
-            : Match(0, 0)
+        while(readIndex >= decodedEnd) // EOF codes don't decode to anything
         {
+            LZ77CodeType code = Geometry::read(*reader);
+            if(!validCode(code))
+                throw LZ77FormatException();
+            if(decodedEnd + maxCodeLength > dataSize)
+                slideData();
+            decodeCode(code);
         }
-    };
-
-    size_t location;
-    size_t getActualLocation(size_t l)
-    {
-        return location - l;
-    }
-
-    shared_ptr<Writer> writer;
-    circularDeque<uint_fast8_t, bufferSize + 1> currentInput;
-    circularDeque<uint_fast8_t, bufferSize + 2> buffer;
-    list<size_t> nodes[uint8_max + 1];
-
-    void addByte(uint_fast8_t v)
-    {
-        nodes[v].push_front(++location);
-        buffer.push_front(v);
-        if(buffer.size() > bufferSize)
+        while(true) // decode the codes that are already buffered without waiting for more
         {
-            buffer.pop_back();
-            for(list<size_t> & nodeList : nodes)
+            size_t available;
+            const uint8_t * p = reader->peekBuffered(available);
+            size_t used = 0;
+            while(available - used >= Geometry::encodedSize && decodedEnd + maxCodeLength <= dataSize)
             {
-                for(auto i = nodeList.begin(); i != nodeList.end();)
-                {
-                    if(getActualLocation(*i) >= buffer.size())
-                        i = nodeList.erase(i);
-                    else
-                        i++;
-                }
+                LZ77CodeType code = Geometry::decode(p + used);
+                if(!validCode(code)) // leave it for the next fill so the bytes before it can be read first
+                    break;
+                decodeCode(code);
+                used += Geometry::encodedSize;
             }
+            if(used == 0)
+                return;
+            reader->skipBuffered(used);
         }
     }
-
-    /*void dumpLocation(size_t l)
+public:
+    BasicExpandReader(shared_ptr<Reader> reader, const vector<uint8_t> & dictionary = vector<uint8_t>())
+        : reader(reader), data(dataSize)
     {
-        cout << l << " : ";
-        l = getActualLocation(l);
-        if(l >= buffer.size())
-            cout << "\"\"" << endl;
-        else
-        {
-            cout << "\"";
-            auto iter = buffer.cbegin() + l;
-            for(int i = 0; i < 5 && i <= l; i++, iter--)
-            {
-                cout << (char)*iter;
-            }
-            cout << "\"" << endl;
-        }
-    }*/
-
-    Match getBiggestMatch()
+        size_t size = dictionary.size() < windowSize ? dictionary.size() : windowSize;
+        if(size != 0)
+            memcpy((void *)&data[0], (const void *)&dictionary[dictionary.size() - size], size);
+        readIndex = decodedEnd = size;
+        totalDecoded = size;
+    }
+    BasicExpandReader(Reader &reader, const vector<uint8_t> & dictionary = vector<uint8_t>())
+        : BasicExpandReader(shared_ptr<Reader>(&reader, [](Reader *) {}), dictionary)
     {
-        Match retval;
-        auto ii = currentInput.cbegin();
-        if(ii == currentInput.cend())
-            return Match();
-        const list<size_t> & curNodes = nodes[*ii++];
-        if(curNodes.empty())
-            return Match();
-        auto startII = ii;
-        for(size_t startPos : curNodes)
-        {
-            size_t matchLength = 1;
-            size_t node = startPos;
-            for(ii = startII; ii != currentInput.cend(); matchLength++, ii++, node++)
-            {
-                size_t pos = getActualLocation(node + 1);
-                if(pos >= buffer.size())
-                    break;
-                if(buffer.cbegin()[pos] != *ii)
-                    break;
-            }
-            if(matchLength > retval.length)
-            {
-                retval.length = matchLength;
-                retval.location = getActualLocation(startPos);
-            }
-        }
-        if(retval.length > LZ77CodeType::maxLength + 1)
-            retval.length = LZ77CodeType::maxLength + 1;
-        return retval;
     }
-
-    void writeCode()
+    virtual ~BasicExpandReader()
     {
-        if(currentInput.empty())
-            return;
-        if(currentInput.size() == 1)
-        {
-            addByte(currentInput.front());
-            LZ77CodeType(currentInput.front()).write(*writer);
-            currentInput.pop_front();
-            return;
-        }
-        Match m = getBiggestMatch();
-        if(m.length <= 1)
-        {
-            addByte(currentInput.front());
-            LZ77CodeType(currentInput.front()).write(*writer);
-            currentInput.pop_front();
-            return;
-        }
-        m.length--;
-        for(size_t i = 0; i < m.length; i++)
+    }
+    virtual uint8_t readByte() override
+    {
+        if(readIndex >= decodedEnd)
+            fill();
+        return data[readIndex++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        while(count > 0)
         {
-            addByte(currentInput.front());
-            currentInput.pop_front();
+            if(readIndex >= decodedEnd)
+                fill();
+            size_t currentCount = decodedEnd - readIndex;
+            if(currentCount > count)
+                currentCount = count;
+            memcpy((void *)array, (const void *)&data[readIndex], currentCount);
+            readIndex += currentCount;
+            array += currentCount;
+            count -= currentCount;
         }
-        LZ77CodeType code(m.length, m.location, currentInput.front());
-        code.write(*writer);
-        addByte(currentInput.front());
-        currentInput.pop_front();
     }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = decodedEnd - readIndex;
+        if(available == 0)
+            return nullptr;
+        return &data[readIndex];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= decodedEnd - readIndex);
+        readIndex += count;
+    }
+};
 
+/** LZ77 compressor<br/>
+    the level trades speed for compression :
+    levels 1 to 3 take the longest match found with a short search,
+    levels 4 to 6 also check if waiting one byte gives a longer match (lazy matching)
+    and levels 7 to 9 pick the codes for all the buffered input at once to use as few bits as possible<br/>
+    the geometry sets the longest copy and the window size, streams with a geometry other than LZ77LegacyGeometry
+    start with a geometry header and can only be read by a BasicExpandReader with the same geometry
+ */
+template <typename Geometry>
+class BasicCompressWriter final : public Writer
+{
 public:
-    CompressWriter(shared_ptr<Writer> writer)
-        : writer(writer)
+    static constexpr int minLevel = 1, maxLevel = 9, defaultLevel = 5;
+    static constexpr size_t maxDictionarySize = Geometry::windowSize;
+private:
+    static constexpr size_t windowSize = Geometry::windowSize; // the farthest back a match can start
+    static constexpr size_t maxCopyLength = Geometry::maxLength;
+    static constexpr size_t maxCodeLength = maxCopyLength + 1; // the copied bytes and the next byte
+    static constexpr size_t optimalLookaheadSize = 4 * maxCodeLength > 1024 ? 4 * maxCodeLength : 1024;
+    static constexpr size_t dataSize = 4 * windowSize;
+    static constexpr int hashBits = Geometry::offsetBits < 12 ? 12 : Geometry::offsetBits; // bigger windows need more hash entries
+    static constexpr size_t hashSize = (size_t)1 << hashBits;
+    enum class Parser
     {
-    }
-    CompressWriter(Writer &writer)
-        : CompressWriter(shared_ptr<Writer>(&writer, [](Writer *) {}))
+        Greedy,
+        Lazy,
+        Optimal
+    };
+    struct LevelParameters final
+    {
+        size_t chainDepth;
+        Parser parser;
+    };
+    static LevelParameters getLevelParameters(int level);
+
+    // positions are absolute and wrap around at 2^32, every candidate from the tables is checked against
+    // the window so stale entries are skipped instead of being removed when they leave the window
+    // a position is only hashed once everything before it is written or searched so the tables never hold positions after the one being searched
+    shared_ptr<Writer> writer;
+    const LevelParameters parameters;
+    const size_t lookaheadSize; // the input collected before codes are written, greedy parsing only needs enough for two codes
+    shared_ptr<LZ77EntropyEncoder> entropyEncoder; // null for the legacy format
+    bool wroteCode = false;
+    // the window and the hash tables are on the heap because they're too big for the stack with wide geometries
+    vector<uint8_t> data; // dataSize bytes : the window followed by the input that hasn't been written yet
+    uint32_t dataStart = 0; // the position of data[0]
+    size_t inputStart = 0, inputEnd = 0;
+    size_t hashedEnd = 0; // the positions before this index are in the hash tables
+    vector<uint32_t> head3; // the last position of each 3 byte prefix hash
+    vector<uint32_t> chain3; // the previous position with the same 3 byte prefix hash, indexed by position % windowSize
+    vector<uint32_t> last2; // the last position of each 2 byte prefix hash
+    uint32_t last1[256]; // the last position of each byte
+    struct Match final
+    {
+        size_t copyLength = 0, distance = 0;
+    };
+    uint32_t lazyPosition = 0; // the position of lazyMatch, the match found by lazy matching for the next code
+    bool haveLazyMatch = false;
+    Match lazyMatch;
+    struct ParseStep final // for optimal parsing
     {
+        Match match; // the longest match here, any shorter copy from the same distance matches too
+        size_t cost; // the lowest cost of coding from here to the end of the parsed input
+        size_t copyLength; // the copy length of the first code of that coding
+    };
+    vector<ParseStep> parseSteps;
+
+    void slideData();
+    void hashUpTo(size_t end);
+    size_t maxCopyAt(size_t index) const
+    {
+        size_t available = inputEnd - index - 1; // a code always ends with one byte that isn't copied
+        return available < maxCopyLength ? available : maxCopyLength;
     }
-    virtual ~CompressWriter()
+    size_t matchLength(size_t index, size_t distance, size_t maxLength) const; // the match can overlap the input because the decoder copies a byte at a time
+    Match findMatch(size_t index) const;
+    Match findCodeMatch(size_t index);
+    void writeCode(size_t index, size_t copyLength, size_t distance);
+    void writeGreedyCode();
+    void writeOptimalCodes(bool all);
+    void writeCodes(bool all);
+public:
+    /** @param dictionary the preset dictionary, see maxLZ77DictionarySize
+     */
+    explicit BasicCompressWriter(shared_ptr<Writer> writer, int level = defaultLevel, LZ77Format format = LZ77Format::Legacy,
+                                 const vector<uint8_t> & dictionary = vector<uint8_t>());
+    explicit BasicCompressWriter(Writer &writer, int level = defaultLevel, LZ77Format format = LZ77Format::Legacy,
+                                 const vector<uint8_t> & dictionary = vector<uint8_t>())
+        : BasicCompressWriter(shared_ptr<Writer>(&writer, [](Writer *) {}), level, format, dictionary)
     {
     }
-    virtual void flush() override
+    virtual ~BasicCompressWriter()
     {
-        while(!currentInput.empty())
-            writeCode();
-        writer->flush();
     }
+    /** a sync flush : codes all the input, ends the entropy coded block and flushes the underlying writer
+        so the reader can read every byte written so far, the window is kept so the next bytes compress as well as before<br/>
+        use AutoFlushWriter to flush automatically after a delay
+     */
+    virtual void flush() override;
     virtual void writeByte(uint8_t v) override
     {
-        currentInput.push_back(v);
-        if(currentInput.size() < bufferSize)
-            return;
-        writeCode();
+        if(inputEnd >= dataSize)
+            slideData();
+        data[inputEnd++] = v;
+        if(inputEnd - inputStart >= lookaheadSize)
+            writeCodes(false);
     }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
 };
 
+typedef BasicExpandReader<LZ77LegacyGeometry> ExpandReader;
+typedef BasicCompressWriter<LZ77LegacyGeometry> CompressWriter;
+typedef BasicExpandReader<LZ77WideGeometry> WideExpandReader;
+typedef BasicCompressWriter<LZ77WideGeometry> WideCompressWriter;
+
 #endif // COMPRESSED_STREAM_H_INCLUDED
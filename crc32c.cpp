@@ -0,0 +1,105 @@
+#include "crc32c.h"
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HAS_SSE42
+#endif
+
+using namespace std;
+
+namespace
+{
+const uint32_t polynomial = 0x82F63B78; // reversed Castagnoli polynomial
+
+struct Tables final
+{
+    uint32_t table[8][256];
+    Tables()
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for(int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+            table[0][i] = crc;
+        }
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            for(int j = 1; j < 8; j++)
+                table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xFF];
+        }
+    }
+};
+
+const Tables & getTables()
+{
+    static const Tables tables;
+    return tables;
+}
+
+uint32_t crc32cTable(const uint8_t * data, size_t size, uint32_t crc)
+{
+    const Tables & t = getTables();
+    while(size >= 8)
+    {
+        uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = t.table[7][low & 0xFF] ^ t.table[6][(low >> 8) & 0xFF] ^ t.table[5][(low >> 16) & 0xFF] ^ t.table[4][low >> 24]
+              ^ t.table[3][data[4]] ^ t.table[2][data[5]] ^ t.table[1][data[6]] ^ t.table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while(size-- > 0)
+        crc = (crc >> 8) ^ t.table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC32C_HAS_SSE42
+__attribute__((target("sse4.2"))) uint32_t crc32cSSE42(const uint8_t * data, size_t size, uint32_t crc)
+{
+    while(size > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while(size >= 8)
+    {
+        uint64_t v;
+        memcpy((void *)&v, (const void *)data, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while(size >= 4)
+    {
+        uint32_t v;
+        memcpy((void *)&v, (const void *)data, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+        data += 4;
+        size -= 4;
+    }
+    while(size-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+
+bool haveSSE42()
+{
+    static const bool retval = __builtin_cpu_supports("sse4.2");
+    return retval;
+}
+#endif
+}
+
+uint32_t crc32c(const uint8_t * data, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+#ifdef CRC32C_HAS_SSE42
+    if(haveSSE42())
+        return ~crc32cSSE42(data, size, crc);
+#endif
+    return ~crc32cTable(data, size, crc);
+}
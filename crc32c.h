@@ -0,0 +1,14 @@
+#ifndef CRC32C_H_INCLUDED
+#define CRC32C_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+
+/** compute the CRC-32C (Castagnoli) of data<br/>
+    crc is the result of a previous call so data can be processed in pieces :
+    crc32c(b, crc32c(a)) is the crc of a followed by b<br/>
+    uses the SSE4.2 crc32 instruction when the processor has it and a slicing-by-8 table otherwise
+ */
+uint32_t crc32c(const uint8_t * data, size_t size, uint32_t crc = 0);
+
+#endif // CRC32C_H_INCLUDED
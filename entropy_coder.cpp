@@ -0,0 +1,410 @@
+#include "entropy_coder.h"
+#include <algorithm>
+#include <queue>
+
+using namespace std;
+
+constexpr uint8_t LZ77EntropyFormat::magic[3];
+
+namespace
+{
+size_t offsetBucket(size_t offset)
+{
+    size_t retval = 0;
+    while(offset != 0)
+    {
+        retval++;
+        offset >>= 1;
+    }
+    return retval;
+}
+
+void setFlatLengths(HuffmanTable & table) // every symbol gets the same length, or one more bit for the last symbols when the count isn't a power of 2
+{
+    size_t symbolCount = table.symbolCount();
+    uint8_t bits = 0;
+    while(((size_t)2 << bits) <= symbolCount)
+        bits++;
+    size_t longCodes = 2 * (symbolCount - ((size_t)1 << bits));
+    vector<uint8_t> lengths(symbolCount, bits);
+    for(size_t i = symbolCount - longCodes; i < symbolCount; i++)
+        lengths[i] = bits + 1;
+    table.setLengths(lengths.data());
+}
+
+void setDefaultTables(HuffmanTable & literals, HuffmanTable & lengths, HuffmanTable & offsets) // so the first blocks don't need tables
+{
+    setFlatLengths(literals);
+    setFlatLengths(lengths);
+    setFlatLengths(offsets);
+}
+
+uint64_t addCost(uint64_t a, uint64_t b)
+{
+    if(a == (uint64_t)-1 || b == (uint64_t)-1)
+        return (uint64_t)-1;
+    return a + b;
+}
+}
+
+HuffmanTable::HuffmanTable(size_t symbolCount, bool decoding)
+    : lengths(symbolCount, 0), codes(symbolCount, 0), decodeTable(decoding ? (size_t)1 << maxBits : 0, 0)
+{
+}
+
+bool HuffmanTable::assignCodes()
+{
+    size_t lengthCounts[maxBits + 1] = {};
+    for(uint8_t length : lengths)
+        lengthCounts[length]++;
+    uint32_t kraftSum = 0;
+    for(int length = 1; length <= maxBits; length++)
+        kraftSum += (uint32_t)lengthCounts[length] << (maxBits - length);
+    if(kraftSum > ((uint32_t)1 << maxBits))
+        return false;
+    uint32_t nextCode[maxBits + 1];
+    uint32_t code = 0;
+    lengthCounts[0] = 0;
+    for(int length = 1; length <= maxBits; length++)
+    {
+        code = (code + (uint32_t)lengthCounts[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+    for(uint16_t & entry : decodeTable)
+        entry = 0;
+    for(size_t symbol = 0; symbol < lengths.size(); symbol++)
+    {
+        int length = lengths[symbol];
+        if(length == 0)
+            continue;
+        codes[symbol] = (uint16_t)nextCode[length]++;
+        if(decodeTable.empty())
+            continue;
+        size_t first = (size_t)codes[symbol] << (maxBits - length);
+        size_t count = (size_t)1 << (maxBits - length);
+        for(size_t i = first; i < first + count; i++)
+            decodeTable[i] = (uint16_t)(symbol << 4 | length);
+    }
+    return true;
+}
+
+void HuffmanTable::setLengths(const uint8_t * newLengths)
+{
+    lengths.assign(newLengths, newLengths + lengths.size());
+    bool valid = assignCodes();
+    assert(valid);
+    (void)valid;
+}
+
+void HuffmanTable::build(const uint32_t * counts)
+{
+    vector<uint32_t> weights(counts, counts + lengths.size());
+    vector<size_t> parents;
+    while(true)
+    {
+        typedef pair<uint64_t, size_t> Node; // weight and index
+        priority_queue<Node, vector<Node>, greater<Node>> queue;
+        parents.assign(lengths.size(), 0);
+        for(size_t symbol = 0; symbol < lengths.size(); symbol++)
+        {
+            if(weights[symbol] != 0)
+                queue.push(Node(weights[symbol], symbol));
+        }
+        for(uint8_t & length : lengths)
+            length = 0;
+        if(queue.size() == 1)
+        {
+            lengths[queue.top().second] = 1;
+            break;
+        }
+        while(queue.size() > 1)
+        {
+            Node a = queue.top();
+            queue.pop();
+            Node b = queue.top();
+            queue.pop();
+            size_t parent = parents.size();
+            parents.push_back(0);
+            parents[a.second] = parent;
+            parents[b.second] = parent;
+            queue.push(Node(a.first + b.first, parent));
+        }
+        int maxLength = 0;
+        for(size_t symbol = 0; symbol < lengths.size(); symbol++)
+        {
+            if(weights[symbol] == 0)
+                continue;
+            int length = 0;
+            for(size_t node = symbol; node != parents.size() - 1; node = parents[node])
+                length++;
+            lengths[symbol] = (uint8_t)min(length, 15);
+            maxLength = max(maxLength, length);
+        }
+        if(maxLength <= maxBits)
+            break;
+        for(uint32_t & weight : weights) // flatten the distribution until the codes are short enough
+        {
+            if(weight != 0)
+                weight = (weight >> 1) | 1;
+        }
+    }
+    assignCodes();
+}
+
+uint64_t HuffmanTable::cost(const uint32_t * counts) const
+{
+    uint64_t retval = 0;
+    for(size_t symbol = 0; symbol < lengths.size(); symbol++)
+    {
+        if(counts[symbol] == 0)
+            continue;
+        if(lengths[symbol] == 0)
+            return (uint64_t)-1;
+        retval += (uint64_t)counts[symbol] * lengths[symbol];
+    }
+    return retval;
+}
+
+uint64_t HuffmanTable::tableCost() const
+{
+    uint64_t retval = 0;
+    for(size_t symbol = 0; symbol < lengths.size();)
+    {
+        retval += 4;
+        if(lengths[symbol] != 0)
+        {
+            symbol++;
+            continue;
+        }
+        size_t run = 1;
+        while(run < 16 && symbol + run < lengths.size() && lengths[symbol + run] == 0)
+            run++;
+        retval += 4;
+        symbol += run;
+    }
+    return retval;
+}
+
+void HuffmanTable::writeLengths(BitWriter & writer) const
+{
+    for(size_t symbol = 0; symbol < lengths.size();)
+    {
+        writer.write(lengths[symbol], 4);
+        if(lengths[symbol] != 0)
+        {
+            symbol++;
+            continue;
+        }
+        size_t run = 1;
+        while(run < 16 && symbol + run < lengths.size() && lengths[symbol + run] == 0)
+            run++;
+        writer.write((uint32_t)(run - 1), 4);
+        symbol += run;
+    }
+}
+
+void HuffmanTable::readLengths(BitReader & reader)
+{
+    for(size_t symbol = 0; symbol < lengths.size();)
+    {
+        reader.refill();
+        uint8_t length = (uint8_t)reader.read(4);
+        if(length > maxBits)
+            throw LZ77FormatException();
+        if(length != 0)
+        {
+            lengths[symbol++] = length;
+            continue;
+        }
+        size_t run = reader.read(4) + 1;
+        if(symbol + run > lengths.size())
+            throw LZ77FormatException();
+        for(size_t i = 0; i < run; i++)
+            lengths[symbol++] = 0;
+    }
+    if(!assignCodes())
+        throw LZ77FormatException();
+}
+
+LZ77EntropyEncoder::LZ77EntropyEncoder(size_t maxLength, int offsetBits)
+    : literals(LZ77EntropyFormat::literalSymbols, false), lengths(LZ77EntropyFormat::lengthSymbols(maxLength), false), offsets(LZ77EntropyFormat::offsetSymbols(offsetBits), false),
+      literalCounts(LZ77EntropyFormat::literalSymbols), lengthCounts(LZ77EntropyFormat::lengthSymbols(maxLength)), offsetCounts(LZ77EntropyFormat::offsetSymbols(offsetBits)),
+      literalHistory(LZ77EntropyFormat::literalSymbols), lengthHistory(LZ77EntropyFormat::lengthSymbols(maxLength)), offsetHistory(LZ77EntropyFormat::offsetSymbols(offsetBits)),
+      newLiterals(LZ77EntropyFormat::literalSymbols, false), newLengths(LZ77EntropyFormat::lengthSymbols(maxLength), false),
+      newOffsets(LZ77EntropyFormat::offsetSymbols(offsetBits), false),
+      endOfBlock(LZ77EntropyFormat::endOfBlock(maxLength))
+{
+    setDefaultTables(literals, lengths, offsets);
+    codes.reserve(LZ77EntropyFormat::maxBlockCodes);
+}
+
+size_t LZ77EntropyEncoder::offsetCost(size_t offset) const
+{
+    size_t bucket = offsetBucket(offset);
+    return symbolCost(offsets, bucket) + (bucket > 1 ? bucket - 1 : 0);
+}
+
+void LZ77EntropyEncoder::writeBlock(Writer & writer)
+{
+    if(codes.empty())
+        return;
+    for(uint32_t & v : literalCounts)
+        v = 0;
+    for(uint32_t & v : lengthCounts)
+        v = 0;
+    for(uint32_t & v : offsetCounts)
+        v = 0;
+    for(const Code & code : codes)
+    {
+        literalCounts[code.nextByte]++;
+        lengthCounts[code.length]++;
+        if(code.length != 0)
+            offsetCounts[offsetBucket(code.offset)]++;
+    }
+    lengthCounts[endOfBlock]++;
+    auto addHistory = [](vector<uint32_t> & history, const vector<uint32_t> & blockCounts)
+    {
+        for(size_t i = 0; i < history.size(); i++)
+            history[i] += blockCounts[i];
+    };
+    addHistory(literalHistory, literalCounts);
+    addHistory(lengthHistory, lengthCounts);
+    addHistory(offsetHistory, offsetCounts);
+
+    // new tables are built from the recent blocks and sent when they would have paid for themselves on the recent blocks,
+    // small blocks (from frequent flushes) keep the tables until enough codes have been written to make checking worthwhile
+    auto totalCost = [this](const HuffmanTable & literals, const HuffmanTable & lengths, const HuffmanTable & offsets, bool history)
+    {
+        return addCost(addCost(literals.cost((history ? literalHistory : literalCounts).data()), lengths.cost((history ? lengthHistory : lengthCounts).data())),
+                       offsets.cost((history ? offsetHistory : offsetCounts).data()));
+    };
+    bool mustSendTables = totalCost(literals, lengths, offsets, false) == (uint64_t)-1;
+    codesSinceTablesChecked += codes.size();
+    bool newTables = false;
+    if(mustSendTables || codesSinceTablesChecked >= minCheckedCodes)
+    {
+        codesSinceTablesChecked = 0;
+        newLiterals.build(literalHistory.data());
+        newLengths.build(lengthHistory.data());
+        newOffsets.build(offsetHistory.data());
+        uint64_t tableCost = newLiterals.tableCost() + newLengths.tableCost() + newOffsets.tableCost();
+        newTables = mustSendTables || tableCost + totalCost(newLiterals, newLengths, newOffsets, true) < totalCost(literals, lengths, offsets, true);
+    }
+    payload.clear();
+    BitWriter bitWriter(payload);
+    if(newTables)
+    {
+        swap(literals, newLiterals);
+        swap(lengths, newLengths);
+        swap(offsets, newOffsets);
+        literals.writeLengths(bitWriter);
+        lengths.writeLengths(bitWriter);
+        offsets.writeLengths(bitWriter);
+    }
+    for(const Code & code : codes)
+    {
+        lengths.write(bitWriter, code.length);
+        if(code.length != 0)
+        {
+            size_t bucket = offsetBucket(code.offset);
+            offsets.write(bitWriter, bucket);
+            if(bucket > 1)
+                bitWriter.write(code.offset & (((uint32_t)1 << (bucket - 1)) - 1), (int)bucket - 1);
+        }
+        literals.write(bitWriter, code.nextByte);
+    }
+    lengths.write(bitWriter, endOfBlock);
+    bitWriter.finish();
+    codes.clear();
+    auto decayHistory = [](vector<uint32_t> & history) // so the tables follow changes in the data
+    {
+        uint64_t total = 0;
+        for(uint32_t v : history)
+            total += v;
+        if(total <= 2 * LZ77EntropyFormat::maxBlockCodes)
+            return;
+        for(uint32_t & v : history)
+            v /= 2;
+    };
+    decayHistory(literalHistory);
+    decayHistory(lengthHistory);
+    decayHistory(offsetHistory);
+
+    if(!wroteHeader)
+    {
+        writer.writeBytes(LZ77EntropyFormat::magic, sizeof(LZ77EntropyFormat::magic));
+        writer.writeU8(LZ77EntropyFormat::version);
+        wroteHeader = true;
+    }
+    writer.writeVarU32((uint32_t)(payload.size() << 1 | (newTables ? 1 : 0)));
+    writer.writeBytes(payload.data(), payload.size());
+}
+
+LZ77EntropyDecoder::LZ77EntropyDecoder(size_t maxLength, int offsetBits)
+    : literals(LZ77EntropyFormat::literalSymbols), lengths(LZ77EntropyFormat::lengthSymbols(maxLength)), offsets(LZ77EntropyFormat::offsetSymbols(offsetBits)),
+      endOfBlock(LZ77EntropyFormat::endOfBlock(maxLength)), maxPayloadSize(LZ77EntropyFormat::maxPayloadSize(maxLength, offsetBits))
+{
+    setDefaultTables(literals, lengths, offsets);
+}
+
+bool LZ77EntropyDecoder::readBlock(Reader & reader, vector<LZ77CodeType> & codes)
+{
+    uint8_t v;
+    try
+    {
+        v = reader.readU8();
+    }
+    catch(EOFException &)
+    {
+        return false;
+    }
+    uint32_t header = v & 0x7F;
+    try
+    {
+        for(int shift = 7; v & 0x80; shift += 7) // the rest of the VarU32
+        {
+            if(shift > 21) // longer than any valid block
+                throw LZ77FormatException();
+            v = reader.readU8();
+            header |= (uint32_t)(v & 0x7F) << shift;
+        }
+        size_t payloadSize = header >> 1;
+        if(payloadSize == 0 || payloadSize > maxPayloadSize)
+            throw LZ77FormatException();
+        payload.resize(payloadSize);
+        reader.readBytes(payload.data(), payloadSize);
+    }
+    catch(EOFException &)
+    {
+        throw LZ77FormatException();
+    }
+    BitReader bitReader(payload.data(), payload.size());
+    if(header & 1)
+    {
+        literals.readLengths(bitReader);
+        lengths.readLengths(bitReader);
+        offsets.readLengths(bitReader);
+    }
+    codes.clear();
+    while(true)
+    {
+        bitReader.refill();
+        size_t length = lengths.read(bitReader);
+        if(length == endOfBlock)
+            break;
+        if(codes.size() >= LZ77EntropyFormat::maxBlockCodes)
+            throw LZ77FormatException();
+        LZ77CodeType code(length, 0, 0);
+        if(code.length != 0)
+        {
+            size_t bucket = offsets.read(bitReader);
+            if(bucket > 0)
+                code.offset = ((size_t)1 << (bucket - 1)) | bitReader.read((int)bucket - 1);
+        }
+        code.nextByte = (uint8_t)literals.read(bitReader);
+        codes.push_back(code);
+    }
+    if(bitReader.overran())
+        throw LZ77FormatException();
+    return true;
+}
@@ -0,0 +1,242 @@
+#ifndef ENTROPY_CODER_H_INCLUDED
+#define ENTROPY_CODER_H_INCLUDED
+
+#include "compressed_stream.h"
+#include <vector>
+
+// entropy coded LZ77 format :
+// 3 byte magic number ("LZH"), a legacy stream can't start with it because its first code would copy from before the start
+// U8 version
+// blocks until the end of the stream :
+//   VarU32 payload size << 1 | 1 if the payload starts with new huffman tables
+//   payload : a bit stream, most significant bit first, padded with zeros to a whole byte :
+//     the new tables, otherwise the tables of the previous block (or the default tables) are used :
+//       the code length of each literal, length and offset bucket symbol as 4 bits,
+//       a code length of 0 is followed by 4 bits with the number of following symbols that are also 0
+//     the codes :
+//       the length symbol (LZ77CodeType::length), there are maxLength + 2 length symbols and offsetBits + 1 offset bucket symbols for the geometry
+//       if the length isn't 0 the offset bucket symbol and bucket - 1 extra bits, offset = bucket == 0 ? 0 : 1 << (bucket - 1) | extra
+//       the literal symbol (LZ77CodeType::nextByte)
+//     the end of block length symbol
+
+struct LZ77EntropyFormat final
+{
+    static constexpr uint8_t magic[3] = {'L', 'Z', 'H'};
+    static constexpr uint8_t version = 1;
+    static constexpr size_t literalSymbols = 256;
+    static constexpr int maxCodeBits = 12;
+    static constexpr size_t maxBlockCodes = 4096;
+    static constexpr size_t lengthSymbols(size_t maxLength)
+    {
+        return maxLength + 2;
+    }
+    static constexpr size_t endOfBlock(size_t maxLength) // the length symbol after the last code
+    {
+        return maxLength + 1;
+    }
+    static constexpr size_t offsetSymbols(int offsetBits)
+    {
+        return offsetBits + 1;
+    }
+    static constexpr size_t maxPayloadSize(size_t maxLength, int offsetBits)
+    {
+        return ((maxBlockCodes + 1) * (3 * maxCodeBits + offsetBits - 1) + (literalSymbols + lengthSymbols(maxLength) + offsetSymbols(offsetBits)) * 4) / 8 + 1;
+    }
+};
+
+class BitWriter final
+{
+private:
+    vector<uint8_t> & output;
+    uint64_t buffer = 0;
+    int bitCount = 0;
+public:
+    explicit BitWriter(vector<uint8_t> & output)
+        : output(output)
+    {
+    }
+    void write(uint32_t value, int bits) // bits <= 32
+    {
+        buffer = (buffer << bits) | value;
+        bitCount += bits;
+        while(bitCount >= 8)
+        {
+            bitCount -= 8;
+            output.push_back((uint8_t)(buffer >> bitCount));
+        }
+    }
+    void finish() // pad to a whole byte
+    {
+        if(bitCount > 0)
+            write(0, 8 - bitCount);
+    }
+};
+
+class BitReader final
+{
+private:
+    const uint8_t * const start;
+    const uint8_t * p;
+    const uint8_t * const end;
+    uint64_t buffer = 0; // the next bits are the most significant bits
+    int bitCount = 0;
+    size_t paddingBytes = 0; // zero bytes read after the end
+public:
+    BitReader(const uint8_t * data, size_t size)
+        : start(data), p(data), end(data + size)
+    {
+    }
+    void refill() // makes at least 56 bits available
+    {
+        while(bitCount <= 56)
+        {
+            uint8_t v = 0;
+            if(p < end)
+                v = *p++;
+            else
+                paddingBytes++;
+            buffer |= (uint64_t)v << (56 - bitCount);
+            bitCount += 8;
+        }
+    }
+    uint32_t peek(int bits) const // bits > 0
+    {
+        return (uint32_t)(buffer >> (64 - bits));
+    }
+    void skip(int bits)
+    {
+        buffer <<= bits;
+        bitCount -= bits;
+    }
+    uint32_t read(int bits)
+    {
+        if(bits == 0)
+            return 0;
+        uint32_t retval = peek(bits);
+        skip(bits);
+        return retval;
+    }
+    bool overran() const
+    {
+        return (size_t)(p - start + paddingBytes) * 8 - bitCount > (size_t)(end - start) * 8;
+    }
+};
+
+/** a canonical huffman code with codes up to LZ77EntropyFormat::maxCodeBits long
+ */
+class HuffmanTable final
+{
+private:
+    static constexpr int maxBits = LZ77EntropyFormat::maxCodeBits;
+    vector<uint8_t> lengths;
+    vector<uint16_t> codes;
+    vector<uint16_t> decodeTable; // indexed by the next maxBits bits : symbol << 4 | code length, a code length of 0 is an invalid code
+    bool assignCodes(); // returns false if the lengths aren't a prefix code
+public:
+    /** @param decoding build the table for read()
+     */
+    HuffmanTable(size_t symbolCount, bool decoding = true);
+    size_t symbolCount() const
+    {
+        return lengths.size();
+    }
+    int codeLength(size_t symbol) const // 0 if symbol doesn't have a code
+    {
+        return lengths[symbol];
+    }
+    void setLengths(const uint8_t * newLengths);
+    void build(const uint32_t * counts); // all the symbols with a count get a code
+    /** @return the number of bits to encode the symbols with counts or (uint64_t)-1 if a symbol with a count doesn't have a code
+     */
+    uint64_t cost(const uint32_t * counts) const;
+    uint64_t tableCost() const; // the number of bits writeLengths writes
+    void writeLengths(BitWriter & writer) const;
+    /** @throws LZ77FormatException if the lengths aren't valid
+     */
+    void readLengths(BitReader & reader);
+    void write(BitWriter & writer, size_t symbol) const
+    {
+        writer.write(codes[symbol], lengths[symbol]);
+    }
+    size_t read(BitReader & reader) const // there must be maxBits bits available
+    {
+        uint16_t entry = decodeTable[reader.peek(maxBits)];
+        if((entry & 0xF) == 0)
+            throw LZ77FormatException();
+        reader.skip(entry & 0xF);
+        return entry >> 4;
+    }
+};
+
+/** collects LZ77 codes and writes them as entropy coded blocks
+ */
+class LZ77EntropyEncoder final
+{
+private:
+    static constexpr size_t minCheckedCodes = 256; // the codes written before checking if new tables would be better
+    struct Code final
+    {
+        uint16_t length;
+        uint16_t offset;
+        uint8_t nextByte;
+    };
+    vector<Code> codes;
+    HuffmanTable literals, lengths, offsets;
+    vector<uint32_t> literalCounts, lengthCounts, offsetCounts;
+    vector<uint32_t> literalHistory, lengthHistory, offsetHistory; // decaying counts from the previous blocks
+    HuffmanTable newLiterals, newLengths, newOffsets;
+    size_t codesSinceTablesChecked = 0;
+    const size_t endOfBlock;
+    vector<uint8_t> payload;
+    bool wroteHeader = false;
+    static size_t symbolCost(const HuffmanTable & table, size_t symbol)
+    {
+        int bits = table.codeLength(symbol);
+        return bits != 0 ? bits : LZ77EntropyFormat::maxCodeBits; // the next tables will give it a code
+    }
+public:
+    /** @param maxLength the geometry's longest copy
+        @param offsetBits the geometry's offset size
+     */
+    LZ77EntropyEncoder(size_t maxLength, int offsetBits);
+    void addCode(const LZ77CodeType & code)
+    {
+        codes.push_back(Code{(uint16_t)code.length, (uint16_t)code.offset, code.nextByte});
+    }
+    bool full() const
+    {
+        return codes.size() >= LZ77EntropyFormat::maxBlockCodes;
+    }
+    // the bits the parts of a code take with the current tables, so a parse can be priced before it's coded
+    size_t lengthCost(size_t length) const
+    {
+        return symbolCost(lengths, length);
+    }
+    size_t literalCost(uint8_t literal) const
+    {
+        return symbolCost(literals, literal);
+    }
+    size_t offsetCost(size_t offset) const; // the bucket symbol and the extra bits
+    /** write the collected codes as a block, doesn't write anything if there are no codes
+     */
+    void writeBlock(Writer & writer);
+};
+
+/** reads the blocks written by LZ77EntropyEncoder after the magic number and version
+ */
+class LZ77EntropyDecoder final
+{
+private:
+    HuffmanTable literals, lengths, offsets;
+    const size_t endOfBlock, maxPayloadSize;
+    vector<uint8_t> payload;
+public:
+    LZ77EntropyDecoder(size_t maxLength, int offsetBits);
+    /** replaces codes with the codes in the next block
+        @return false at the end of the stream
+        @throws LZ77FormatException if the block isn't valid
+     */
+    bool readBlock(Reader & reader, vector<LZ77CodeType> & codes);
+};
+
+#endif // ENTROPY_CODER_H_INCLUDED
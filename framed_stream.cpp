@@ -0,0 +1,177 @@
+#include "framed_stream.h"
+#include "crc32c.h"
+#include <algorithm>
+
+using namespace std;
+
+FrameWriter::FrameWriter(shared_ptr<Writer> writer, size_t maxPayloadSize)
+    : writer(writer), maxPayloadSize(limit<size_t>(maxPayloadSize, 1, FrameFormat::maxPayloadSize))
+{
+    payload.reserve(this->maxPayloadSize);
+}
+
+FrameWriter::~FrameWriter()
+{
+    try
+    {
+        writeFrame();
+    }
+    catch(IOException &)
+    {
+    }
+}
+
+void FrameWriter::writeFrame()
+{
+    if(payload.empty())
+        return;
+    uint8_t header[FrameFormat::headerSize] =
+    {
+        FrameFormat::magic0, FrameFormat::magic1, (uint8_t)(payload.size() >> 8), (uint8_t)(payload.size() & 0xFF), 0
+    };
+    header[4] = (uint8_t)crc32c(header, 4);
+    uint32_t crc = crc32c(&header[2], 2);
+    crc = crc32c(payload.data(), payload.size(), crc);
+    uint8_t trailer[FrameFormat::trailerSize] =
+    {
+        (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc
+    };
+    const IOVector vectors[3] =
+    {
+        IOVector(header, sizeof(header)), IOVector(payload.data(), payload.size()), IOVector(trailer, sizeof(trailer))
+    };
+    writer->writeVectored(vectors, 3);
+    payload.clear();
+}
+
+void FrameWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        size_t currentCount = min(count, maxPayloadSize - payload.size());
+        payload.insert(payload.end(), array, array + currentCount);
+        array += currentCount;
+        count -= currentCount;
+        if(payload.size() >= maxPayloadSize)
+            writeFrame();
+    }
+}
+
+FrameReader::FrameReader(shared_ptr<Reader> reader, size_t maxPayloadSize)
+    : reader(reader), maxPayloadSize(limit<size_t>(maxPayloadSize, 1, FrameFormat::maxPayloadSize)), goodFrames(0), corruptFrames(0), skippedBytes(0)
+{
+}
+
+void FrameReader::fillRaw(size_t count) // make sure there are at least count unparsed bytes without reading more than needed
+{
+    while(raw.size() - rawStart < count)
+    {
+        size_t needed = count - (raw.size() - rawStart);
+        size_t available;
+        const uint8_t * p = reader->peekBuffered(available);
+        if(available > 0)
+        {
+            available = min(available, needed);
+            raw.insert(raw.end(), p, p + available);
+            reader->skipBuffered(available);
+        }
+        else
+        {
+            raw.push_back(reader->readByte());
+        }
+    }
+}
+
+void FrameReader::dropRaw(size_t count)
+{
+    rawStart += count;
+    if(rawStart >= raw.size())
+    {
+        raw.clear();
+        rawStart = 0;
+    }
+    else if(rawStart >= 4096 && rawStart * 2 >= raw.size())
+    {
+        raw.erase(raw.begin(), raw.begin() + rawStart);
+        rawStart = 0;
+    }
+}
+
+void FrameReader::readNextFrame()
+{
+    frame.clear();
+    frameOffset = 0;
+    while(true)
+    {
+        fillRaw(1);
+        const uint8_t * start = &raw[rawStart];
+        const uint8_t * magic = (const uint8_t *)memchr((const void *)start, FrameFormat::magic0, raw.size() - rawStart);
+        if(magic == nullptr)
+        {
+            skippedBytes += raw.size() - rawStart;
+            dropRaw(raw.size() - rawStart);
+            continue;
+        }
+        if(magic != start)
+        {
+            skippedBytes += magic - start;
+            dropRaw(magic - start);
+        }
+        fillRaw(FrameFormat::headerSize);
+        const uint8_t * header = &raw[rawStart];
+        if(header[1] != FrameFormat::magic1)
+        {
+            skippedBytes++;
+            dropRaw(1);
+            continue;
+        }
+        size_t payloadSize = ((size_t)header[2] << 8) | header[3];
+        if(header[4] != (uint8_t)crc32c(header, 4) || payloadSize == 0 || payloadSize > maxPayloadSize)
+        {
+            corruptFrames++;
+            skippedBytes++;
+            dropRaw(1);
+            continue;
+        }
+        fillRaw(FrameFormat::headerSize + payloadSize + FrameFormat::trailerSize);
+        header = &raw[rawStart];
+        const uint8_t * payload = header + FrameFormat::headerSize;
+        const uint8_t * trailer = payload + payloadSize;
+        uint32_t crc = crc32c(&header[2], 2);
+        crc = crc32c(payload, payloadSize, crc);
+        uint32_t readCrc = ((uint32_t)trailer[0] << 24) | ((uint32_t)trailer[1] << 16) | ((uint32_t)trailer[2] << 8) | trailer[3];
+        if(crc != readCrc)
+        {
+            corruptFrames++; // the real frame could start inside this one so only skip the magic number
+            skippedBytes++;
+            dropRaw(1);
+            continue;
+        }
+        frame.assign(payload, payload + payloadSize);
+        dropRaw(FrameFormat::headerSize + payloadSize + FrameFormat::trailerSize);
+        goodFrames++;
+        return;
+    }
+}
+
+void FrameReader::readFrame(vector<uint8_t> & retval)
+{
+    while(frameOffset >= frame.size())
+        readNextFrame();
+    retval.assign(frame.begin() + frameOffset, frame.end());
+    frameOffset = frame.size();
+}
+
+void FrameReader::readBytes(uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        while(frameOffset >= frame.size())
+            readNextFrame();
+        size_t currentCount = min(count, frame.size() - frameOffset);
+        memcpy((void *)array, (const void *)&frame[frameOffset], currentCount);
+        frameOffset += currentCount;
+        array += currentCount;
+        count -= currentCount;
+    }
+}
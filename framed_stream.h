@@ -0,0 +1,131 @@
+#ifndef FRAMED_STREAM_H_INCLUDED
+#define FRAMED_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include <vector>
+#include <atomic>
+
+// frame format :
+// 2 byte magic number (0xFA 0xCE)
+// U16 payload length
+// U8 low byte of the CRC-32C of the magic number and length, checked before waiting for the payload
+// payload
+// U32 CRC-32C of the length and payload
+
+struct FrameFormat final
+{
+    static constexpr uint8_t magic0 = 0xFA, magic1 = 0xCE;
+    static constexpr size_t headerSize = 5, trailerSize = 4;
+    static constexpr size_t maxPayloadSize = 0xFFFF;
+};
+
+/** writes everything written to it as CRC-32C checked frames<br/>
+    each flush ends the current frame
+ */
+class FrameWriter final : public Writer
+{
+private:
+    shared_ptr<Writer> writer;
+    const size_t maxPayloadSize;
+    vector<uint8_t> payload;
+    void writeFrame();
+public:
+    FrameWriter(shared_ptr<Writer> writer, size_t maxPayloadSize = FrameFormat::maxPayloadSize);
+    FrameWriter(Writer &writer, size_t maxPayloadSize = FrameFormat::maxPayloadSize)
+        : FrameWriter(shared_ptr<Writer>(&writer, [](Writer *) {}), maxPayloadSize)
+    {
+    }
+    virtual ~FrameWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        payload.push_back(v);
+        if(payload.size() >= maxPayloadSize)
+            writeFrame();
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override
+    {
+        writeFrame();
+        writer->flush();
+    }
+};
+
+/** reads the payloads of frames written by FrameWriter<br/>
+    frames that fail the CRC check are dropped and counted and the reader resynchronizes on the next magic number
+ */
+class FrameReader final : public Reader
+{
+private:
+    shared_ptr<Reader> reader;
+    const size_t maxPayloadSize;
+    vector<uint8_t> raw; // bytes read from reader that haven't been parsed yet
+    size_t rawStart = 0;
+    vector<uint8_t> frame;
+    size_t frameOffset = 0;
+    atomic<uint64_t> goodFrames, corruptFrames, skippedBytes;
+    void fillRaw(size_t count);
+    void dropRaw(size_t count);
+    void readNextFrame();
+public:
+    /** @param maxPayloadSize frames with longer payloads are treated as corrupt so a corrupted length can't make the reader wait for bytes that aren't coming
+     */
+    FrameReader(shared_ptr<Reader> reader, size_t maxPayloadSize = FrameFormat::maxPayloadSize);
+    FrameReader(Reader &reader, size_t maxPayloadSize = FrameFormat::maxPayloadSize)
+        : FrameReader(shared_ptr<Reader>(&reader, [](Reader *) {}), maxPayloadSize)
+    {
+    }
+    /** read the rest of the current frame or the next frame if the current frame is finished
+     */
+    void readFrame(vector<uint8_t> & retval);
+    virtual uint8_t readByte() override
+    {
+        while(frameOffset >= frame.size())
+            readNextFrame();
+        return frame[frameOffset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = frame.size() - frameOffset;
+        if(available == 0)
+            return nullptr;
+        return &frame[frameOffset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= frame.size() - frameOffset);
+        frameOffset += count;
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        reader->setCancellationToken(token);
+    }
+    /** readable if a checked payload is buffered or the underlying reader is readable,
+        reading can still wait for the rest of a frame that has only started to arrive
+     */
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        if(frameOffset < frame.size())
+        {
+            if(cancellationToken)
+                cancellationToken->check();
+            return true;
+        }
+        return reader->waitReadable(deadline);
+    }
+    uint64_t getGoodFrames() const
+    {
+        return goodFrames;
+    }
+    uint64_t getCorruptFrames() const
+    {
+        return corruptFrames;
+    }
+    uint64_t getSkippedBytes() const
+    {
+        return skippedBytes;
+    }
+};
+
+#endif // FRAMED_STREAM_H_INCLUDED
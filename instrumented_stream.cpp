@@ -0,0 +1,257 @@
+#include "instrumented_stream.h"
+#include <list>
+#include <map>
+
+using namespace std;
+
+namespace
+{
+mutex & getRegistryLock()
+{
+    static mutex retval;
+    return retval;
+}
+
+list<const StreamStats *> & getRegistry()
+{
+    static list<const StreamStats *> retval;
+    return retval;
+}
+}
+
+uint64_t LatencyHistogram::Snapshot::percentileNanoseconds(double p) const
+{
+    if(count == 0)
+        return 0;
+    uint64_t target = (uint64_t)ceil(limit<double>(p, 0, 1) * count);
+    if(target == 0)
+        target = 1;
+    uint64_t sum = 0;
+    for(size_t i = 0; i < bucketCount; i++)
+    {
+        sum += buckets[i];
+        if(sum >= target)
+        {
+            uint64_t retval = (i + 1 >= 64) ? ~(uint64_t)0 : ((uint64_t)1 << (i + 1));
+            if(retval > maxNanoseconds)
+                retval = maxNanoseconds;
+            return retval;
+        }
+    }
+    return maxNanoseconds;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot retval;
+    for(size_t i = 0; i < bucketCount; i++)
+        retval.buckets[i] = buckets[i].load(memory_order_relaxed);
+    retval.count = count.load(memory_order_relaxed);
+    retval.totalNanoseconds = totalNanoseconds.load(memory_order_relaxed);
+    retval.maxNanoseconds = maxNanoseconds.load(memory_order_relaxed);
+    return retval;
+}
+
+void StreamStats::Snapshot::writeLine(ostream & os, const Snapshot * previous) const
+{
+    Snapshot delta = *this;
+    double seconds = 0;
+    if(previous)
+    {
+        delta.bytes -= previous->bytes;
+        delta.calls -= previous->calls;
+        delta.flushes -= previous->flushes;
+        delta.exceptions -= previous->exceptions;
+        for(size_t i = 0; i < LatencyHistogram::bucketCount; i++)
+            delta.latency.buckets[i] -= previous->latency.buckets[i];
+        delta.latency.count -= previous->latency.count;
+        delta.latency.totalNanoseconds -= previous->latency.totalNanoseconds;
+        seconds = chrono::duration_cast<chrono::duration<double>>(time - previous->time).count();
+    }
+    os << "stream-stats name=" << name;
+    os << " bytes=" << delta.bytes;
+    os << " calls=" << delta.calls;
+    os << " flushes=" << delta.flushes;
+    os << " exceptions=" << delta.exceptions;
+    if(seconds > 0)
+        os << " bytes_per_s=" << (uint64_t)(delta.bytes / seconds);
+    os << " latency_count=" << delta.latency.count;
+    os << " latency_avg_ns=" << (uint64_t)delta.latency.averageNanoseconds();
+    os << " latency_p50_ns=" << delta.latency.percentileNanoseconds(0.5);
+    os << " latency_p99_ns=" << delta.latency.percentileNanoseconds(0.99);
+    os << " latency_max_ns=" << latency.maxNanoseconds;
+    os << "\n";
+}
+
+StreamStats::StreamStats(string name)
+    : name(name), bytes(0), calls(0), flushes(0), exceptions(0)
+{
+    lock_guard<mutex> lockIt(getRegistryLock());
+    getRegistry().push_back(this);
+}
+
+StreamStats::~StreamStats()
+{
+    lock_guard<mutex> lockIt(getRegistryLock());
+    getRegistry().remove(this);
+}
+
+StreamStats::Snapshot StreamStats::snapshot() const
+{
+    Snapshot retval;
+    retval.name = name;
+    retval.stats = this;
+    retval.bytes = bytes.load(memory_order_relaxed);
+    retval.calls = calls.load(memory_order_relaxed);
+    retval.flushes = flushes.load(memory_order_relaxed);
+    retval.exceptions = exceptions.load(memory_order_relaxed);
+    retval.latency = latency.snapshot();
+    retval.time = StreamClock::now();
+    return retval;
+}
+
+vector<StreamStats::Snapshot> StreamStats::snapshotAll()
+{
+    vector<Snapshot> retval;
+    lock_guard<mutex> lockIt(getRegistryLock());
+    for(const StreamStats * stats : getRegistry())
+        retval.push_back(stats->snapshot());
+    return retval;
+}
+
+uint8_t InstrumentedReader::readByte()
+{
+    try
+    {
+        size_t available;
+        reader->peekBuffered(available);
+        if(available > 0)
+        {
+            uint8_t retval = reader->readByte();
+            stats->addBytes(1);
+            return retval;
+        }
+        StreamClock::time_point startTime = StreamClock::now();
+        uint8_t retval = reader->readByte();
+        stats->latency.record(StreamClock::now() - startTime);
+        stats->addBytes(1);
+        return retval;
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void InstrumentedReader::readBytes(uint8_t * array, size_t count)
+{
+    try
+    {
+        StreamClock::time_point startTime = StreamClock::now();
+        reader->readBytes(array, count);
+        stats->latency.record(StreamClock::now() - startTime);
+        stats->addBytes(count);
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void InstrumentedWriter::writeByte(uint8_t v)
+{
+    try
+    {
+        writer->writeByte(v);
+        stats->addBytes(1);
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void InstrumentedWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    try
+    {
+        writer->writeBytes(array, count);
+        stats->addBytes(count);
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void InstrumentedWriter::writeVectored(const IOVector * vectors, size_t count)
+{
+    try
+    {
+        writer->writeVectored(vectors, count);
+        size_t byteCount = 0;
+        for(size_t i = 0; i < count; i++)
+            byteCount += vectors[i].size;
+        stats->addBytes(byteCount);
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void InstrumentedWriter::flush()
+{
+    try
+    {
+        StreamClock::time_point startTime = StreamClock::now();
+        writer->flush();
+        stats->latency.record(StreamClock::now() - startTime);
+        stats->addFlush();
+    }
+    catch(...)
+    {
+        stats->addException();
+        throw;
+    }
+}
+
+void StreamStatsReporter::run(StreamClock::duration period, ostream * os)
+{
+    map<const StreamStats *, StreamStats::Snapshot> previousSnapshots;
+    unique_lock<mutex> lockIt(lock);
+    StreamClock::time_point nextTime = StreamClock::now() + period;
+    while(!done)
+    {
+        if(cond.wait_until(lockIt, nextTime) != cv_status::timeout)
+            continue;
+        nextTime += period;
+        map<const StreamStats *, StreamStats::Snapshot> snapshots; // only the stats that still exist so a new one at the same address starts over
+        for(const StreamStats::Snapshot & snapshot : StreamStats::snapshotAll())
+        {
+            auto iter = previousSnapshots.find(snapshot.stats);
+            if(iter == previousSnapshots.end())
+                snapshot.writeLine(*os);
+            else
+                snapshot.writeLine(*os, &iter->second);
+            snapshots[snapshot.stats] = snapshot;
+        }
+        previousSnapshots.swap(snapshots);
+        os->flush();
+    }
+}
+
+StreamStatsReporter::~StreamStatsReporter()
+{
+    {
+        lock_guard<mutex> lockIt(lock);
+        done = true;
+        cond.notify_all();
+    }
+    reporterThread.join();
+}
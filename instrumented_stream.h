@@ -0,0 +1,230 @@
+#ifndef INSTRUMENTED_STREAM_H_INCLUDED
+#define INSTRUMENTED_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+#include <iostream>
+
+/** histogram of latencies with power of 2 sized buckets<br/>
+    bucket i counts latencies in [2^i, 2^(i + 1)) nanoseconds
+ */
+class LatencyHistogram final
+{
+public:
+    static constexpr size_t bucketCount = 40;
+    struct Snapshot final
+    {
+        uint64_t buckets[bucketCount];
+        uint64_t count = 0;
+        uint64_t totalNanoseconds = 0;
+        uint64_t maxNanoseconds = 0;
+        Snapshot()
+        {
+            for(uint64_t & v : buckets)
+                v = 0;
+        }
+        double averageNanoseconds() const
+        {
+            if(count == 0)
+                return 0;
+            return (double)totalNanoseconds / count;
+        }
+        /** @return the upper bound of the bucket containing the fraction p of the samples
+         */
+        uint64_t percentileNanoseconds(double p) const;
+    };
+private:
+    atomic<uint64_t> buckets[bucketCount];
+    atomic<uint64_t> count, totalNanoseconds, maxNanoseconds;
+    static void add(atomic<uint64_t> & v, uint64_t amount)
+    {
+        v.fetch_add(amount, memory_order_relaxed);
+    }
+public:
+    LatencyHistogram()
+        : count(0), totalNanoseconds(0), maxNanoseconds(0)
+    {
+        for(atomic<uint64_t> & v : buckets)
+            v.store(0, memory_order_relaxed);
+    }
+    void record(uint64_t nanoseconds)
+    {
+        size_t bucket = 0;
+        for(uint64_t v = nanoseconds >> 1; v != 0 && bucket < bucketCount - 1; v >>= 1)
+            bucket++;
+        add(buckets[bucket], 1);
+        add(count, 1);
+        add(totalNanoseconds, nanoseconds);
+        uint64_t oldMax = maxNanoseconds.load(memory_order_relaxed);
+        while(nanoseconds > oldMax && !maxNanoseconds.compare_exchange_weak(oldMax, nanoseconds, memory_order_relaxed))
+        {
+        }
+    }
+    void record(StreamClock::duration duration)
+    {
+        record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(duration).count());
+    }
+    Snapshot snapshot() const;
+};
+
+/** counters for an instrumented stream<br/>
+    the counters can be shared by streams used from different threads and can be read from any thread
+ */
+class StreamStats final
+{
+    StreamStats(const StreamStats &) = delete;
+    const StreamStats & operator =(const StreamStats &) = delete;
+public:
+    struct Snapshot final
+    {
+        string name;
+        const StreamStats * stats = nullptr; // the counters this is a snapshot of, names don't have to be unique
+        uint64_t bytes = 0;
+        uint64_t calls = 0;
+        uint64_t flushes = 0;
+        uint64_t exceptions = 0;
+        LatencyHistogram::Snapshot latency;
+        StreamClock::time_point time;
+        /** write a one line summary of the difference from previous
+         */
+        void writeLine(ostream & os, const Snapshot * previous = nullptr) const;
+    };
+private:
+    const string name;
+    atomic<uint64_t> bytes, calls, flushes, exceptions;
+    static void add(atomic<uint64_t> & v, uint64_t amount)
+    {
+        v.fetch_add(amount, memory_order_relaxed);
+    }
+public:
+    LatencyHistogram latency;
+    explicit StreamStats(string name);
+    ~StreamStats();
+    const string & getName() const
+    {
+        return name;
+    }
+    void addBytes(uint64_t count)
+    {
+        add(bytes, count);
+        add(calls, 1);
+    }
+    void addFlush()
+    {
+        add(flushes, 1);
+    }
+    void addException()
+    {
+        add(exceptions, 1);
+    }
+    Snapshot snapshot() const;
+    /** @return snapshots of all the StreamStats that currently exist
+     */
+    static vector<Snapshot> snapshotAll();
+};
+
+/** reader decorator that counts bytes, calls and exceptions<br/>
+    the latency histogram records the time spent in reads that had to go to the underlying stream
+ */
+class InstrumentedReader final : public Reader
+{
+private:
+    shared_ptr<Reader> reader;
+    shared_ptr<StreamStats> stats;
+public:
+    InstrumentedReader(shared_ptr<Reader> reader, shared_ptr<StreamStats> stats)
+        : reader(reader), stats(stats)
+    {
+    }
+    InstrumentedReader(shared_ptr<Reader> reader, string name)
+        : InstrumentedReader(reader, make_shared<StreamStats>(name))
+    {
+    }
+    shared_ptr<StreamStats> getStats() const
+    {
+        return stats;
+    }
+    virtual uint8_t readByte() override;
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        return reader->peekBuffered(available);
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        reader->skipBuffered(count);
+        if(count > 0)
+            stats->addBytes(count);
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        reader->setCancellationToken(token);
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        return reader->waitReadable(deadline);
+    }
+};
+
+/** writer decorator that counts bytes, calls, flushes and exceptions<br/>
+    the latency histogram records the time spent in each flush
+ */
+class InstrumentedWriter final : public Writer
+{
+private:
+    shared_ptr<Writer> writer;
+    shared_ptr<StreamStats> stats;
+public:
+    InstrumentedWriter(shared_ptr<Writer> writer, shared_ptr<StreamStats> stats)
+        : writer(writer), stats(stats)
+    {
+    }
+    InstrumentedWriter(shared_ptr<Writer> writer, string name)
+        : InstrumentedWriter(writer, make_shared<StreamStats>(name))
+    {
+    }
+    shared_ptr<StreamStats> getStats() const
+    {
+        return stats;
+    }
+    virtual void writeByte(uint8_t v) override;
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void writeVectored(const IOVector * vectors, size_t count) override;
+    virtual void flush() override;
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        cancellationToken = token;
+        writer->setCancellationToken(token);
+    }
+    virtual bool waitWritable(StreamClock::time_point deadline) override
+    {
+        return writer->waitWritable(deadline);
+    }
+};
+
+/** writes a stats line for every StreamStats to os every period
+ */
+class StreamStatsReporter final
+{
+    StreamStatsReporter(const StreamStatsReporter &) = delete;
+    const StreamStatsReporter & operator =(const StreamStatsReporter &) = delete;
+private:
+    mutex lock;
+    condition_variable cond;
+    bool done = false;
+    thread reporterThread;
+    void run(StreamClock::duration period, ostream * os);
+public:
+    explicit StreamStatsReporter(StreamClock::duration period, ostream & os = cerr)
+    {
+        reporterThread = thread(&StreamStatsReporter::run, this, period, &os);
+    }
+    ~StreamStatsReporter();
+};
+
+#endif // INSTRUMENTED_STREAM_H_INCLUDED
@@ -0,0 +1,230 @@
+#include "stream.h"
+#include "compressed_stream.h"
+#include "capture_stream.h"
+#include "util.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+// trains a preset dictionary for CompressWriter and ExpandReader from capture files
+// the dictionary only helps until a stream's own bytes fill the window so it's trained on the first records of each capture
+// writes the dictionary bytes to the output file and the compressed size of the training records with and without it to stdout
+// usage : lz77-dictionary-trainer [--size=<bytes>] [--records=<count>] [--kind=read|write|all] <output file> <capture file>...
+
+namespace
+{
+constexpr size_t kmerSize = 6; // the shortest string that's worth a code
+constexpr size_t segmentSize = 32; // the dictionary is built from pieces of this size
+constexpr int kmerHashBits = 20;
+
+struct Session final
+{
+    vector<vector<uint8_t>> records;
+};
+
+size_t hashKmer(const uint8_t * p)
+{
+    uint64_t v = 0;
+    for(size_t i = 0; i < kmerSize; i++)
+        v = (v << 8) | p[i];
+    return (size_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - kmerHashBits));
+}
+
+vector<Session> readSessions(const vector<string> & fileNames, int kind, size_t recordsPerSession)
+{
+    vector<Session> retval;
+    for(const string & fileName : fileNames)
+    {
+        FILE * f = fopen(fileName.c_str(), "rb");
+        if(f == nullptr)
+            throw IOException("IO Error : can't open " + fileName);
+        CaptureFileReader file(make_shared<FileReader>(f));
+        Session sessions[2]; // one for each direction, they're compressed separately
+        CaptureRecord record;
+        while(file.readRecord(record))
+        {
+            if(record.kind == CaptureKind::Gap || record.data.empty())
+                continue;
+            if(kind >= 0 && (int)record.kind != kind)
+                continue;
+            Session & session = sessions[(int)record.kind];
+            if(session.records.size() < recordsPerSession)
+                session.records.push_back(move(record.data));
+        }
+        for(Session & session : sessions)
+        {
+            if(!session.records.empty())
+                retval.push_back(move(session));
+        }
+    }
+    return retval;
+}
+
+/** picks the segments that contain the most strings that are common to many records, the best segment goes last
+    so it's nearest to the data and stays in the window longest
+ */
+vector<uint8_t> train(const vector<Session> & sessions, size_t size)
+{
+    vector<const vector<uint8_t> *> samples;
+    for(const Session & session : sessions)
+    {
+        for(const vector<uint8_t> & record : session.records)
+        {
+            if(record.size() >= kmerSize)
+                samples.push_back(&record);
+        }
+    }
+    // the score of a string is the number of records it's in
+    vector<uint32_t> frequencies((size_t)1 << kmerHashBits, 0);
+    {
+        vector<uint32_t> lastSample((size_t)1 << kmerHashBits, (uint32_t)-1);
+        for(size_t i = 0; i < samples.size(); i++)
+        {
+            const vector<uint8_t> & sample = *samples[i];
+            for(size_t j = 0; j + kmerSize <= sample.size(); j++)
+            {
+                size_t h = hashKmer(&sample[j]);
+                if(lastSample[h] != (uint32_t)i)
+                {
+                    lastSample[h] = (uint32_t)i;
+                    frequencies[h]++;
+                }
+            }
+        }
+    }
+    vector<vector<uint8_t>> segments;
+    size_t totalSize = 0;
+    vector<uint16_t> activeCounts((size_t)1 << kmerHashBits, 0); // the times each string is in the current window
+    while(totalSize < size)
+    {
+        // slide a window over every sample keeping the sum of the scores of the distinct strings in it
+        uint64_t bestScore = 0;
+        const vector<uint8_t> * bestSample = nullptr;
+        size_t bestStart = 0, bestLength = 0;
+        for(const vector<uint8_t> * psample : samples)
+        {
+            const vector<uint8_t> & sample = *psample;
+            size_t window = min(segmentSize, sample.size());
+            size_t kmerCount = sample.size() - kmerSize + 1, windowKmers = window - kmerSize + 1;
+            uint64_t score = 0;
+            for(size_t j = 0; j < kmerCount; j++)
+            {
+                size_t h = hashKmer(&sample[j]);
+                if(activeCounts[h]++ == 0)
+                    score += frequencies[h];
+                if(j >= windowKmers)
+                {
+                    size_t oldHash = hashKmer(&sample[j - windowKmers]);
+                    if(--activeCounts[oldHash] == 0)
+                        score -= frequencies[oldHash];
+                }
+                if(j + 1 >= windowKmers && score > bestScore)
+                {
+                    bestScore = score;
+                    bestSample = psample;
+                    bestStart = j + 1 - windowKmers;
+                    bestLength = window;
+                }
+            }
+            for(size_t j = kmerCount > windowKmers ? kmerCount - windowKmers : 0; j < kmerCount; j++)
+                activeCounts[hashKmer(&sample[j])] = 0;
+        }
+        if(bestSample == nullptr) // every string is in the dictionary already
+            break;
+        const uint8_t * segment = &(*bestSample)[bestStart];
+        for(size_t j = 0; j + kmerSize <= bestLength; j++)
+            frequencies[hashKmer(&segment[j])] = 0;
+        bestLength = min(bestLength, size - totalSize);
+        segments.push_back(vector<uint8_t>(segment, segment + bestLength));
+        totalSize += bestLength;
+    }
+    vector<uint8_t> retval;
+    for(size_t i = segments.size(); i-- > 0;)
+        retval.insert(retval.end(), segments[i].begin(), segments[i].end());
+    return retval;
+}
+
+size_t compressedSize(const vector<Session> & sessions, const vector<uint8_t> & dictionary)
+{
+    size_t retval = 0;
+    for(const Session & session : sessions)
+    {
+        VectorWriter writer;
+        CompressWriter compressWriter(writer, CompressWriter::defaultLevel, LZ77Format::Entropy, dictionary);
+        for(const vector<uint8_t> & record : session.records)
+        {
+            compressWriter.writeBytes(record.data(), record.size());
+            compressWriter.flush();
+        }
+        retval += writer.getData().size();
+    }
+    return retval;
+}
+}
+
+int main(int argc, char ** argv)
+{
+    size_t size = maxLZ77DictionarySize;
+    size_t recordsPerSession = 32;
+    int kind = -1;
+    vector<string> fileNames;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg.substr(0, 7) == "--size=")
+            size = limit<size_t>(atol(arg.substr(7).c_str()), 1, maxLZ77DictionarySize);
+        else if(arg.substr(0, 10) == "--records=")
+            recordsPerSession = max<long>(1, atol(arg.substr(10).c_str()));
+        else if(arg == "--kind=read")
+            kind = (int)CaptureKind::Read;
+        else if(arg == "--kind=write")
+            kind = (int)CaptureKind::Write;
+        else if(arg == "--kind=all")
+            kind = -1;
+        else
+            fileNames.push_back(arg);
+    }
+    if(fileNames.size() < 2)
+    {
+        cerr << "usage : lz77-dictionary-trainer [--size=<bytes>] [--records=<count>] [--kind=read|write|all] <output file> <capture file>...\n";
+        return 1;
+    }
+    try
+    {
+        string outputFileName = fileNames[0];
+        fileNames.erase(fileNames.begin());
+        vector<Session> sessions = readSessions(fileNames, kind, recordsPerSession);
+        vector<uint8_t> dictionary = train(sessions, size);
+        FILE * f = fopen(outputFileName.c_str(), "wb");
+        if(f == nullptr)
+            throw IOException("IO Error : can't create " + outputFileName);
+        {
+            FileWriter writer(f);
+            writer.writeBytes(dictionary.data(), dictionary.size());
+            writer.flush();
+        }
+        size_t recordCount = 0, uncompressedSize = 0;
+        for(const Session & session : sessions)
+        {
+            for(const vector<uint8_t> & record : session.records)
+            {
+                recordCount++;
+                uncompressedSize += record.size();
+            }
+        }
+        cout << "dictionary : " << dictionary.size() << " bytes from " << recordCount << " records in " << sessions.size() << " sessions\n";
+        cout << "uncompressed : " << uncompressedSize << " bytes\n";
+        cout << "compressed without dictionary : " << compressedSize(sessions, vector<uint8_t>()) << " bytes\n";
+        cout << "compressed with dictionary : " << compressedSize(sessions, dictionary) << " bytes\n";
+    }
+    catch(IOException & e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "mailbox_stream.h"
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+struct Mailbox
+{
+    struct Slot
+    {
+        vector<uint8_t> frame;
+        uint64_t sequence;
+    };
+    mutex lock;
+    condition_variable cond;
+    bool closed = false;
+    map<uint32_t, Slot> slots; // the undelivered frames
+    uint64_t nextSequence = 1;
+    uint64_t supersededFrames = 0;
+    MailboxChannel::KeyFunction keyFunction;
+};
+
+MailboxWriter::~MailboxWriter()
+{
+    lock_guard<mutex> lockIt(mailbox->lock);
+    mailbox->closed = true;
+    mailbox->cond.notify_all();
+}
+
+void MailboxWriter::flush()
+{
+    if(frame.empty())
+        return;
+    uint32_t key = 0;
+    if(mailbox->keyFunction)
+        key = mailbox->keyFunction(frame);
+    lock_guard<mutex> lockIt(mailbox->lock);
+    if(mailbox->closed)
+        throw IOException("IO Error : can't write to mailbox");
+    auto iter = mailbox->slots.find(key);
+    if(iter == mailbox->slots.end())
+        iter = mailbox->slots.insert(make_pair(key, Mailbox::Slot())).first;
+    else
+        mailbox->supersededFrames++;
+    iter->second.frame.swap(frame);
+    iter->second.sequence = mailbox->nextSequence++;
+    frame.clear();
+    mailbox->cond.notify_all();
+}
+
+MailboxReader::~MailboxReader()
+{
+    removeListener();
+    lock_guard<mutex> lockIt(mailbox->lock);
+    mailbox->closed = true;
+    mailbox->cond.notify_all();
+}
+
+void MailboxReader::removeListener()
+{
+    if(cancellationToken)
+        cancellationToken->removeListener(listenerHandle);
+}
+
+void MailboxReader::setCancellationToken(shared_ptr<CancellationToken> token)
+{
+    removeListener();
+    cancellationToken = token;
+    if(token)
+    {
+        shared_ptr<Mailbox> mailbox = this->mailbox;
+        listenerHandle = token->addListener([mailbox]()
+        {
+            lock_guard<mutex> lockIt(mailbox->lock);
+            mailbox->cond.notify_all();
+        });
+    }
+}
+
+bool MailboxReader::waitForFrame(unique_lock<mutex> & lockIt, StreamClock::time_point deadline)
+{
+    while(true)
+    {
+        if(cancellationToken && cancellationToken->cancelled())
+            throw CancelledException();
+        if(!mailbox->slots.empty() || mailbox->closed)
+            return true;
+        if(deadline == StreamClock::time_point::max())
+            mailbox->cond.wait(lockIt);
+        else if(mailbox->cond.wait_until(lockIt, deadline) == cv_status::timeout)
+            return !mailbox->slots.empty() || mailbox->closed;
+    }
+}
+
+bool MailboxReader::waitReadable(StreamClock::time_point deadline)
+{
+    if(frameOffset < frame.size())
+    {
+        if(cancellationToken)
+            cancellationToken->check();
+        return true;
+    }
+    unique_lock<mutex> lockIt(mailbox->lock);
+    return waitForFrame(lockIt, deadline);
+}
+
+void MailboxReader::nextFrame()
+{
+    unique_lock<mutex> lockIt(mailbox->lock);
+    waitForFrame(lockIt, StreamClock::time_point::max());
+    if(mailbox->slots.empty())
+        throw EOFException();
+    auto oldest = mailbox->slots.begin();
+    for(auto iter = mailbox->slots.begin(); iter != mailbox->slots.end(); iter++)
+    {
+        if(iter->second.sequence < oldest->second.sequence)
+            oldest = iter;
+    }
+    frame.swap(oldest->second.frame);
+    frameOffset = 0;
+    sequence = oldest->second.sequence;
+    mailbox->slots.erase(oldest);
+}
+
+void MailboxReader::readBytes(uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        while(frameOffset >= frame.size())
+            nextFrame();
+        size_t currentCount = min(count, frame.size() - frameOffset);
+        memcpy((void *)array, (const void *)&frame[frameOffset], currentCount);
+        frameOffset += currentCount;
+        array += currentCount;
+        count -= currentCount;
+    }
+}
+
+uint64_t MailboxReader::readFrame(vector<uint8_t> & retval)
+{
+    while(frameOffset >= frame.size())
+        nextFrame();
+    retval.assign(frame.begin() + frameOffset, frame.end());
+    frameOffset = frame.size();
+    return sequence;
+}
+
+MailboxChannel::MailboxChannel(KeyFunction keyFunction)
+{
+    mailbox = make_shared<Mailbox>();
+    mailbox->keyFunction = keyFunction;
+    readerInternal = make_shared<MailboxReader>(mailbox);
+    writerInternal = make_shared<MailboxWriter>(mailbox);
+}
+
+uint64_t MailboxChannel::getSupersededFrames() const
+{
+    lock_guard<mutex> lockIt(mailbox->lock);
+    return mailbox->supersededFrames;
+}
@@ -0,0 +1,126 @@
+#ifndef MAILBOX_STREAM_H_INCLUDED
+#define MAILBOX_STREAM_H_INCLUDED
+
+#include "stream.h"
+#include <vector>
+#include <functional>
+
+struct Mailbox;
+
+/** the writing end of a MailboxChannel<br/>
+    each flush completes a frame that replaces any undelivered frame with the same key
+ */
+class MailboxWriter final : public Writer
+{
+private:
+    shared_ptr<Mailbox> mailbox;
+    vector<uint8_t> frame;
+public:
+    explicit MailboxWriter(shared_ptr<Mailbox> mailbox)
+        : mailbox(mailbox)
+    {
+    }
+    virtual ~MailboxWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        frame.push_back(v);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        frame.insert(frame.end(), array, array + count);
+    }
+    virtual void flush() override;
+};
+
+/** the reading end of a MailboxChannel<br/>
+    reads frames in the order they were last updated
+ */
+class MailboxReader final : public Reader
+{
+private:
+    shared_ptr<Mailbox> mailbox;
+    vector<uint8_t> frame;
+    size_t frameOffset = 0;
+    uint64_t sequence = 0;
+    CancellationToken::ListenerHandle listenerHandle;
+    void removeListener();
+    bool waitForFrame(unique_lock<mutex> & lockIt, StreamClock::time_point deadline);
+    void nextFrame();
+public:
+    explicit MailboxReader(shared_ptr<Mailbox> mailbox)
+        : mailbox(mailbox)
+    {
+    }
+    virtual ~MailboxReader();
+    virtual uint8_t readByte() override
+    {
+        while(frameOffset >= frame.size())
+            nextFrame();
+        return frame[frameOffset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    /** read the rest of the current frame or the next frame if the current frame is finished
+        @return the sequence number of the frame
+     */
+    uint64_t readFrame(vector<uint8_t> & retval);
+    /** @return the sequence number of the frame being read, sequence numbers start at 1 and increase with every frame written
+     */
+    uint64_t getSequence() const
+    {
+        return sequence;
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = frame.size() - frameOffset;
+        if(available == 0)
+            return nullptr;
+        return &frame[frameOffset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= frame.size() - frameOffset);
+        frameOffset += count;
+    }
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override;
+    virtual bool waitReadable(StreamClock::time_point deadline) override;
+};
+
+/** a channel like StreamPipe that only keeps the newest frame for each key<br/>
+    so the queue never holds more than one frame per key no matter how fast the writer is
+ */
+class MailboxChannel final
+{
+    MailboxChannel(const MailboxChannel &) = delete;
+    const MailboxChannel & operator =(const MailboxChannel &) = delete;
+public:
+    typedef function<uint32_t(const vector<uint8_t> & frame)> KeyFunction;
+private:
+    shared_ptr<Mailbox> mailbox;
+    shared_ptr<MailboxReader> readerInternal;
+    shared_ptr<MailboxWriter> writerInternal;
+public:
+    /** @param keyFunction gets the key of a frame, all frames have the same key by default
+     */
+    explicit MailboxChannel(KeyFunction keyFunction = nullptr);
+    MailboxReader & reader()
+    {
+        return *readerInternal;
+    }
+    MailboxWriter & writer()
+    {
+        return *writerInternal;
+    }
+    shared_ptr<MailboxReader> preader()
+    {
+        return readerInternal;
+    }
+    shared_ptr<MailboxWriter> pwriter()
+    {
+        return writerInternal;
+    }
+    /** @return the number of frames that were replaced before they were read
+     */
+    uint64_t getSupersededFrames() const;
+};
+
+#endif // MAILBOX_STREAM_H_INCLUDED
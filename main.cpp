@@ -8,6 +8,9 @@
 #include "gui.h"
 #include "stream.h"
 #include "serial.h"
+#include "instrumented_stream.h"
+#include "buffer_pool.h"
+#include "capture_stream.h"
 
 using namespace std;
 
@@ -26,14 +29,25 @@ void writeToStream(string str, shared_ptr<Writer> pwriter)
 void readerThreadFn(shared_ptr<Reader> preader)
 {
     Reader & reader = *preader;
-    while(!done)
+    try
+    {
+        while(!done)
+        {
+            cout << (char)reader.readByte() << flush;
+        }
+    }
+    catch(CancelledException &)
+    {
+    }
+    catch(EOFException &)
     {
-        cout << (char)reader.readByte() << flush;
     }
 }
 
 void communicationThreadFn(shared_ptr<StreamRW> streams)
 {
+    shared_ptr<CancellationToken> readerCancellationToken = make_shared<CancellationToken>();
+    streams->reader().setCancellationToken(readerCancellationToken);
     thread readerThread(readerThreadFn, streams->preader());
     shared_ptr<Writer> pwriter = streams->pwriter();
     writeToStream("  -1  -1  ", pwriter); // reset
@@ -49,6 +63,7 @@ void communicationThreadFn(shared_ptr<StreamRW> streams)
         writeToStream(os.str(), pwriter);
     }
     writeToStream("-1  ", pwriter); // reset
+    readerCancellationToken->cancel(); // so we don't wait for the tank to send another byte
     readerThread.join();
 }
 
@@ -84,8 +99,15 @@ int main(int argc, char ** argv)
     wstring fileName = L"/dev/ttyUSB0";
     if(argv[1])
         fileName = stringToWString(argv[1]);
-    auto fileWriter = make_shared<SerialWriter>(fileName);
-    auto fileReader = make_shared<SerialReader>(fileName);
+    shared_ptr<Writer> fileWriter = make_shared<InstrumentedWriter>(make_shared<SerialWriter>(fileName), "serial-writer");
+    shared_ptr<Reader> fileReader = make_shared<InstrumentedReader>(make_shared<SerialReader>(fileName), "serial-reader");
+    shared_ptr<CaptureRecorder> recorder;
+    if(argc > 2 && argv[2]) // record the serial link to a capture file
+    {
+        recorder = make_shared<CaptureRecorder>(make_shared<FileWriter>(stringToWString(argv[2])));
+        fileWriter = make_shared<RecordingWriter>(fileWriter, recorder);
+        fileReader = make_shared<RecordingReader>(fileReader, recorder);
+    }
     shared_ptr<StreamRW> streams = make_shared<StreamRWWrapper>(fileReader, fileWriter);
     thread communicationThread(communicationThreadFn, streams);
     startGraphics();
@@ -93,5 +115,8 @@ int main(int argc, char ** argv)
     endGraphics();
     done = true;
     communicationThread.join();
+    for(const StreamStats::Snapshot & snapshot : StreamStats::snapshotAll())
+        snapshot.writeLine(cerr);
+    BufferPool::getStats().writeLine(cerr);
     return 0;
 }
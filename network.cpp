@@ -1,10 +1,14 @@
 #include "network.h"
 #include "util.h"
+#include "buffer_pool.h"
 #ifdef _WIN32 // Windows
 #error finish
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
@@ -20,50 +24,194 @@ initializer signalInit([]()
     signal(SIGPIPE, SIG_IGN);
 });
 
+class NetworkReader final : public Reader
+{
+private:
+    static constexpr size_t bufferSize = IOBuffer::capacity;
+    IOBuffer buffer;
+    size_t bufferStart = 0, bufferEnd = 0;
+    int fd;
+    void fillBuffer()
+    {
+        if(cancellationToken)
+            cancellationToken->check();
+        while(true)
+        {
+            ssize_t retval = recv(fd, (void *)buffer.data(), bufferSize, MSG_DONTWAIT); // only poll when there's nothing to read so most reads are one system call
+            if(retval == 0)
+                throw EOFException();
+            if(retval > 0)
+            {
+                bufferStart = 0;
+                bufferEnd = retval;
+                return;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                waitFdReadable(fd, StreamClock::time_point::max(), cancellationToken);
+            else if(errno != EINTR)
+                throw IOException(string("io error : ") + strerror(errno));
+        }
+    }
+public:
+    NetworkReader(int fd)
+        : buffer(IOBuffer::allocate()), fd(fd)
+    {
+    }
+    virtual ~NetworkReader()
+    {
+        close(fd);
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        if(bufferStart < bufferEnd)
+        {
+            if(cancellationToken)
+                cancellationToken->check();
+            return true;
+        }
+        return waitFdReadable(fd, deadline, cancellationToken);
+    }
+    virtual uint8_t readByte() override
+    {
+        if(bufferStart >= bufferEnd)
+            fillBuffer();
+        return buffer.data()[bufferStart++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        while(count > 0)
+        {
+            if(bufferStart >= bufferEnd)
+                fillBuffer();
+            size_t currentCount = bufferEnd - bufferStart;
+            if(currentCount > count)
+                currentCount = count;
+            memcpy((void *)array, (const void *)(buffer.data() + bufferStart), currentCount);
+            bufferStart += currentCount;
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = bufferEnd - bufferStart;
+        if(available == 0)
+            return nullptr;
+        return buffer.data() + bufferStart;
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= bufferEnd - bufferStart);
+        bufferStart += count;
+    }
+};
+
 class NetworkWriter final : public Writer
 {
 private:
-    vector<uint8_t> buffer;
+    static constexpr size_t bufferSize = IOBuffer::capacity;
+    IOBuffer buffer;
+    size_t bufferUsed = 0;
     int fd;
 public:
     NetworkWriter(int fd)
-        : fd(fd)
+        : buffer(IOBuffer::allocate()), fd(fd)
     {
         int flag = 1;
         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); // so writes only poll when the socket buffer is full
     }
     virtual ~NetworkWriter()
     {
         close(fd);
     }
+    virtual bool waitWritable(StreamClock::time_point deadline) override
+    {
+        if(bufferUsed < bufferSize)
+        {
+            if(cancellationToken)
+                cancellationToken->check();
+            return true;
+        }
+        return waitFdWritable(fd, deadline, cancellationToken);
+    }
     virtual void writeByte(uint8_t v)
     {
-        buffer.push_back(v);
-        if(buffer.size() >= 16384)
+        buffer.data()[bufferUsed++] = v;
+        if(bufferUsed >= bufferSize)
             flush();
     }
-    virtual void flush()
+    virtual void writeBytes(const uint8_t * array, size_t count) override
     {
-        const uint8_t * pbuffer = buffer.data();
-        ssize_t sizeLeft = buffer.size();
-        while(sizeLeft > 0)
+        if(bufferUsed + count >= bufferSize)
         {
-            ssize_t retval = send(fd, (const void *)pbuffer, sizeLeft, 0);
-            if(retval == -1)
-            {
-                throw IOException(string("io error : ") + strerror(errno));
-            }
-            else
-            {
-                sizeLeft -= retval;
-                pbuffer += retval;
-            }
+            IOVector vector(array, count);
+            writeVectored(&vector, 1);
+            return;
         }
+        memcpy((void *)(buffer.data() + bufferUsed), (const void *)array, count);
+        bufferUsed += count;
+    }
+    /** sends the buffered bytes and vectors with one writev without copying vectors
+     */
+    virtual void writeVectored(const IOVector * vectors, size_t count) override
+    {
+        IOVector smallVectors[16];
+        vector<IOVector> bigVectors;
+        IOVector * allVectors = &smallVectors[0];
+        if(count + 1 > sizeof(smallVectors) / sizeof(smallVectors[0]))
+        {
+            bigVectors.resize(count + 1);
+            allVectors = bigVectors.data();
+        }
+        allVectors[0] = IOVector(buffer.data(), bufferUsed);
+        for(size_t i = 0; i < count; i++)
+            allVectors[i + 1] = vectors[i];
+        writeFdVectored(fd, allVectors, count + 1, cancellationToken);
+        bufferUsed = 0;
+    }
+    virtual void flush()
+    {
+        IOVector vector(buffer.data(), bufferUsed);
+        writeFdVectored(fd, &vector, 1, cancellationToken);
         int flag = 1;
         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
-        buffer.clear();
+        bufferUsed = 0;
     }
 };
+
+shared_ptr<StreamRW> acceptConnection(int fd) // returns nullptr if there isn't a connection waiting
+{
+    int fd2 = ::accept(fd, nullptr, nullptr);
+
+    if(fd2 < 0)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+            return nullptr;
+        string msg = "accept: ";
+        msg += strerror(errno);
+        throw NetworkException(msg);
+    }
+
+    int flag = 1;
+    setsockopt(fd2, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
+
+    shared_ptr<Reader> reader = shared_ptr<Reader>(new NetworkReader(dup(fd2)));
+    shared_ptr<Writer> writer = shared_ptr<Writer>(new NetworkWriter(fd2));
+    return shared_ptr<StreamRW>(new StreamRWWrapper(reader, writer));
+}
+
+sockaddr_un makeUnixAddress(wstring path)
+{
+    string str = wstringToString(path);
+    sockaddr_un addr;
+    memset((void *)&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(str.size() >= sizeof(addr.sun_path))
+        throw NetworkException("socket path too long");
+    memcpy((void *)addr.sun_path, (const void *)str.c_str(), str.size());
+    return addr;
+}
 }
 
 NetworkConnection::NetworkConnection(wstring url, uint16_t port)
@@ -114,7 +262,7 @@ NetworkConnection::NetworkConnection(wstring url, uint16_t port)
     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
 
     freeaddrinfo(addrList);
-    readerInternal = unique_ptr<Reader>(new FileReader(fdopen(dup(fd), "r")));
+    readerInternal = unique_ptr<Reader>(new NetworkReader(dup(fd)));
     writerInternal = unique_ptr<Writer>(new NetworkWriter(fd));
 }
 
@@ -157,7 +305,7 @@ NetworkServer::NetworkServer(uint16_t port)
         }
 
         int temp = errno;
-        close(fd);
+        ::close(fd);
         errno = temp;
         errorStr = "bind";
         fd = -1;
@@ -177,32 +325,97 @@ NetworkServer::NetworkServer(uint16_t port)
     {
         string msg = "listen: ";
         msg += strerror(errno);
-        close(fd);
+        ::close(fd);
         throw NetworkException(msg);
     }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); // so a connection that goes away between poll and accept doesn't block accept
 }
 
 NetworkServer::~NetworkServer()
 {
-    close(fd);
+    ::close(fd);
 }
 
 shared_ptr<StreamRW> NetworkServer::accept()
 {
-    int fd2 = ::accept(fd, nullptr, nullptr);
+    while(true)
+    {
+        shared_ptr<StreamRW> retval = tryAccept();
+        if(retval != nullptr)
+            return retval;
+        waitFdReadable(fd, StreamClock::time_point::max(), nullptr);
+    }
+}
 
-    if(fd2 < 0)
+shared_ptr<StreamRW> NetworkServer::tryAccept()
+{
+    return acceptConnection(fd);
+}
+
+UnixSocketConnection::UnixSocketConnection(wstring path)
+{
+    sockaddr_un addr = makeUnixAddress(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        throw NetworkException(string("socket: ") + strerror(errno));
+    if(-1 == connect(fd, (const sockaddr *)&addr, sizeof(addr)))
     {
-        string msg = "accept: ";
+        string msg = "can't connect: ";
         msg += strerror(errno);
+        close(fd);
         throw NetworkException(msg);
     }
+    readerInternal = shared_ptr<Reader>(new NetworkReader(dup(fd)));
+    writerInternal = shared_ptr<Writer>(new NetworkWriter(fd));
+}
 
-    int flag = 1;
-    setsockopt(fd2, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
+UnixSocketServer::UnixSocketServer(wstring path)
+    : path(wstringToString(path))
+{
+    sockaddr_un addr = makeUnixAddress(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        throw NetworkException(string("socket: ") + strerror(errno));
+    struct stat oldFile;
+    if(lstat(this->path.c_str(), &oldFile) == 0 && S_ISSOCK(oldFile.st_mode))
+        unlink(this->path.c_str()); // remove the socket left by a previous server, anything else at path makes bind fail
+    if(::bind(fd, (const sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        string msg = "bind: ";
+        msg += strerror(errno);
+        ::close(fd);
+        throw NetworkException(msg);
+    }
+    if(listen(fd, 50) == -1)
+    {
+        string msg = "listen: ";
+        msg += strerror(errno);
+        ::close(fd);
+        unlink(this->path.c_str());
+        throw NetworkException(msg);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
 
-    shared_ptr<Reader> reader = shared_ptr<Reader>(new FileReader(fdopen(dup(fd2), "r")));
-    shared_ptr<Writer> writer = shared_ptr<Writer>(new NetworkWriter(fd2));
-    return shared_ptr<StreamRW>(new StreamRWWrapper(reader, writer));
+UnixSocketServer::~UnixSocketServer()
+{
+    ::close(fd);
+    unlink(path.c_str());
+}
+
+shared_ptr<StreamRW> UnixSocketServer::accept()
+{
+    while(true)
+    {
+        shared_ptr<StreamRW> retval = tryAccept();
+        if(retval != nullptr)
+            return retval;
+        waitFdReadable(fd, StreamClock::time_point::max(), nullptr);
+    }
+}
+
+shared_ptr<StreamRW> UnixSocketServer::tryAccept()
+{
+    return acceptConnection(fd);
 }
 #endif
@@ -45,6 +45,48 @@ public:
     explicit NetworkServer(uint16_t port);
     ~NetworkServer();
     shared_ptr<StreamRW> accept() override;
+    int pollFd() override
+    {
+        return fd;
+    }
+    shared_ptr<StreamRW> tryAccept() override;
+};
+
+class UnixSocketConnection final : public StreamRW
+{
+private:
+    shared_ptr<Reader> readerInternal;
+    shared_ptr<Writer> writerInternal;
+public:
+    explicit UnixSocketConnection(wstring path);
+    shared_ptr<Reader> preader() override
+    {
+        return readerInternal;
+    }
+    shared_ptr<Writer> pwriter() override
+    {
+        return writerInternal;
+    }
+};
+
+/** a server listening on a UNIX domain socket, the socket file is removed when the server is destroyed
+ */
+class UnixSocketServer final : public StreamServer
+{
+    UnixSocketServer(const UnixSocketServer &) = delete;
+    const UnixSocketServer & operator =(const UnixSocketServer &) = delete;
+private:
+    int fd;
+    string path;
+public:
+    explicit UnixSocketServer(wstring path);
+    ~UnixSocketServer();
+    shared_ptr<StreamRW> accept() override;
+    int pollFd() override
+    {
+        return fd;
+    }
+    shared_ptr<StreamRW> tryAccept() override;
 };
 
 #endif // NETWORK_H_INCLUDED
@@ -0,0 +1,211 @@
+#include "parallel_compressed_stream.h"
+#include "util.h"
+#include <algorithm>
+
+using namespace std;
+
+constexpr uint8_t ParallelLZ77Format::magic[4];
+
+namespace
+{
+template <typename T>
+future<T> submitTask(ThreadPool & pool, function<T()> fn)
+{
+    auto task = make_shared<packaged_task<T()>>(fn);
+    future<T> retval = task->get_future();
+    pool.submit([task]()
+    {
+        (*task)();
+    });
+    return retval;
+}
+}
+
+ParallelCompressWriter::ParallelCompressWriter(shared_ptr<Writer> writer, size_t blockSize, int level, LZ77Format format, ThreadPool * pool, size_t maxPendingBlocks)
+    : writer(writer),
+      pool(pool ? *pool : ThreadPool::get()),
+      blockSize(limit<size_t>(blockSize, 1, ParallelLZ77Format::maxBlockSize)),
+      level(level),
+      format(format),
+      maxPendingBlocks(maxPendingBlocks != 0 ? maxPendingBlocks : 2 * this->pool.getThreadCount())
+{
+    block = make_shared<vector<uint8_t>>();
+    block->reserve(this->blockSize);
+}
+
+ParallelCompressWriter::~ParallelCompressWriter()
+{
+    try
+    {
+        flush();
+    }
+    catch(IOException &)
+    {
+    }
+}
+
+void ParallelCompressWriter::writePendingBlock()
+{
+    PendingBlock & pendingBlock = pendingBlocks.front();
+    vector<uint8_t> compressed = pendingBlock.compressed.get();
+    if(!wroteHeader)
+    {
+        writer->writeBytes(ParallelLZ77Format::magic, sizeof(ParallelLZ77Format::magic));
+        writer->writeU8(ParallelLZ77Format::version);
+        wroteHeader = true;
+    }
+    writer->writeVarU32((uint32_t)pendingBlock.size);
+    writer->writeVarU32((uint32_t)compressed.size());
+    writer->writeBytes(compressed.data(), compressed.size());
+    pendingBlocks.pop_front();
+}
+
+void ParallelCompressWriter::submitBlock()
+{
+    if(block->empty())
+        return;
+    shared_ptr<vector<uint8_t>> data = block;
+    int level = this->level;
+    LZ77Format format = this->format;
+    pendingBlocks.push_back(PendingBlock{data->size(), submitTask<vector<uint8_t>>(pool, [data, level, format]()
+    {
+        vector<uint8_t> retval;
+        retval.reserve(data->size() / 2);
+        VectorWriter compressed(retval);
+        CompressWriter compressWriter(compressed, level, format);
+        compressWriter.writeBytes(data->data(), data->size());
+        compressWriter.flush();
+        return retval;
+    })});
+    block = make_shared<vector<uint8_t>>();
+    block->reserve(blockSize);
+    while(!pendingBlocks.empty()) // write the blocks that are done without waiting unless too many are pending
+    {
+        if(pendingBlocks.size() <= maxPendingBlocks && pendingBlocks.front().compressed.wait_for(chrono::seconds(0)) != future_status::ready)
+            break;
+        writePendingBlock();
+    }
+}
+
+void ParallelCompressWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        size_t currentCount = min(count, blockSize - block->size());
+        block->insert(block->end(), array, array + currentCount);
+        array += currentCount;
+        count -= currentCount;
+        if(block->size() >= blockSize)
+            submitBlock();
+    }
+}
+
+void ParallelCompressWriter::flush()
+{
+    submitBlock();
+    while(!pendingBlocks.empty())
+        writePendingBlock();
+    writer->flush();
+}
+
+ParallelExpandReader::ParallelExpandReader(shared_ptr<Reader> reader, ThreadPool * pool, size_t maxPendingBlocks)
+    : reader(reader),
+      pool(pool ? *pool : ThreadPool::get()),
+      maxPendingBlocks(maxPendingBlocks != 0 ? maxPendingBlocks : 2 * this->pool.getThreadCount())
+{
+}
+
+ParallelExpandReader::~ParallelExpandReader()
+{
+}
+
+bool ParallelExpandReader::readBlock()
+{
+    if(!readHeader)
+    {
+        uint8_t magic[sizeof(ParallelLZ77Format::magic)];
+        reader->readBytes(magic, sizeof(magic));
+        if(0 != memcmp((const void *)magic, (const void *)ParallelLZ77Format::magic, sizeof(magic)))
+            throw InvalidDataValueException("not a parallel LZ77 stream");
+        if(reader->readU8() != ParallelLZ77Format::version)
+            throw InvalidDataValueException("unsupported parallel LZ77 version");
+        readHeader = true;
+    }
+    size_t size;
+    try
+    {
+        size = reader->readVarU32();
+    }
+    catch(EOFException &)
+    {
+        return false;
+    }
+    shared_ptr<vector<uint8_t>> compressed;
+    try
+    {
+        size_t compressedSize = reader->readVarU32();
+        if(size > ParallelLZ77Format::maxBlockSize || compressedSize > ParallelLZ77Format::maxCompressedBlockSize)
+            throw LZ77FormatException();
+        compressed = make_shared<vector<uint8_t>>(compressedSize);
+        reader->readBytes(compressed->data(), compressedSize);
+    }
+    catch(EOFException &)
+    {
+        throw LZ77FormatException();
+    }
+    pendingBlocks.push_back(submitTask<vector<uint8_t>>(pool, [compressed, size]()
+    {
+        vector<uint8_t> retval(size);
+        shared_ptr<const uint8_t> memory(compressed, compressed->data());
+        ExpandReader expandReader(make_shared<MemoryReader>(memory, compressed->size()));
+        try
+        {
+            expandReader.readBytes(retval.data(), size);
+        }
+        catch(EOFException &)
+        {
+            throw LZ77FormatException();
+        }
+        return retval;
+    }));
+    return true;
+}
+
+void ParallelExpandReader::fill()
+{
+    while(blockOffset >= block.size())
+    {
+        if(pendingBlocks.empty())
+        {
+            if(ended || !readBlock())
+            {
+                ended = true;
+                throw EOFException();
+            }
+        }
+        // read ahead the blocks that can be read without waiting so they expand while this one is read
+        while(!ended && pendingBlocks.size() < maxPendingBlocks && reader->waitReadable(StreamClock::now()))
+        {
+            if(!readBlock())
+                ended = true;
+        }
+        future<vector<uint8_t>> expanded = move(pendingBlocks.front());
+        pendingBlocks.pop_front();
+        blockOffset = 0;
+        block = expanded.get();
+    }
+}
+
+void ParallelExpandReader::readBytes(uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(blockOffset >= block.size())
+            fill();
+        size_t currentCount = min(count, block.size() - blockOffset);
+        memcpy((void *)array, (const void *)&block[blockOffset], currentCount);
+        blockOffset += currentCount;
+        array += currentCount;
+        count -= currentCount;
+    }
+}
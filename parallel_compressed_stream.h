@@ -0,0 +1,107 @@
+#ifndef PARALLEL_COMPRESSED_STREAM_H_INCLUDED
+#define PARALLEL_COMPRESSED_STREAM_H_INCLUDED
+
+#include "compressed_stream.h"
+#include "thread_pool.h"
+#include <future>
+
+// block parallel LZ77 format :
+// 4 byte magic number ("LZPB")
+// U8 version
+// blocks until the end of the stream :
+//   VarU32 uncompressed size
+//   VarU32 compressed size
+//   a complete CompressWriter stream of the block, blocks don't refer to each other so they can be expanded in any order
+
+struct ParallelLZ77Format final
+{
+    static constexpr uint8_t magic[4] = {'L', 'Z', 'P', 'B'};
+    static constexpr uint8_t version = 1;
+    static constexpr size_t maxBlockSize = (size_t)1 << 24;
+    static constexpr size_t maxCompressedBlockSize = 2 * LZ77LegacyGeometry::encodedSize * maxBlockSize; // legacy codes can expand literals
+};
+
+/** compresses blocks of blockSize bytes on a thread pool and writes them in order<br/>
+    each block is compressed on its own so the compression is slightly worse than CompressWriter at the start of each block,
+    flush writes the partial block so it should only be used at the end of the data
+ */
+class ParallelCompressWriter final : public Writer
+{
+public:
+    static constexpr size_t defaultBlockSize = (size_t)1 << 18;
+private:
+    shared_ptr<Writer> writer;
+    ThreadPool & pool;
+    const size_t blockSize;
+    const int level;
+    const LZ77Format format;
+    const size_t maxPendingBlocks;
+    shared_ptr<vector<uint8_t>> block; // the block being filled
+    struct PendingBlock final
+    {
+        size_t size;
+        future<vector<uint8_t>> compressed;
+    };
+    deque<PendingBlock> pendingBlocks; // in stream order
+    bool wroteHeader = false;
+    void writePendingBlock();
+    void submitBlock();
+public:
+    /** @param pool the pool to compress on, ThreadPool::get() by default
+        @param maxPendingBlocks the number of blocks that can be compressing at once before writing waits, 0 for twice the number of threads
+     */
+    explicit ParallelCompressWriter(shared_ptr<Writer> writer, size_t blockSize = defaultBlockSize, int level = CompressWriter::defaultLevel,
+                                    LZ77Format format = LZ77Format::Entropy, ThreadPool * pool = nullptr, size_t maxPendingBlocks = 0);
+    virtual ~ParallelCompressWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        block->push_back(v);
+        if(block->size() >= blockSize)
+            submitBlock();
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override;
+};
+
+/** reads the format written by ParallelCompressWriter, expanding the blocks that are already readable on a thread pool
+ */
+class ParallelExpandReader final : public Reader
+{
+private:
+    shared_ptr<Reader> reader;
+    ThreadPool & pool;
+    const size_t maxPendingBlocks;
+    bool readHeader = false, ended = false;
+    deque<future<vector<uint8_t>>> pendingBlocks; // in stream order
+    vector<uint8_t> block; // the block being read
+    size_t blockOffset = 0;
+    bool readBlock(); // reads the next block and starts expanding it, returns false at the end of the stream
+    void fill();
+public:
+    /** @param pool the pool to expand on, ThreadPool::get() by default
+        @param maxPendingBlocks the number of blocks that can be read ahead, 0 for twice the number of threads
+     */
+    explicit ParallelExpandReader(shared_ptr<Reader> reader, ThreadPool * pool = nullptr, size_t maxPendingBlocks = 0);
+    virtual ~ParallelExpandReader();
+    virtual uint8_t readByte() override
+    {
+        if(blockOffset >= block.size())
+            fill();
+        return block[blockOffset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = block.size() - blockOffset;
+        if(available == 0)
+            return nullptr;
+        return &block[blockOffset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= block.size() - blockOffset);
+        blockOffset += count;
+    }
+};
+
+#endif // PARALLEL_COMPRESSED_STREAM_H_INCLUDED
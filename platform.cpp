@@ -167,7 +167,7 @@ shared_ptr<Reader> getResourceReader(wstring resource)
 {
     startSDL();
     wstring fname = getResourceFileName(resource);
-    return make_shared<FileReader>(fname);
+    return make_shared<MappedFileReader>(fname);
 }
 #elif __unix
 #error implement getResourceReader for other unix
@@ -0,0 +1,337 @@
+#include "seekable_compressed_stream.h"
+#include "crc32c.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+constexpr uint8_t SeekableLZ77Format::magic[4];
+constexpr uint8_t SeekableLZ77Format::indexMagic[4];
+
+SeekableCompressWriter::SeekableCompressWriter(shared_ptr<Writer> writer, size_t blockSize, int level, LZ77Format format)
+    : writer(writer),
+      blockSize(limit<size_t>(blockSize, 1, SeekableLZ77Format::maxBlockSize)),
+      level(level),
+      format(format)
+{
+    block.reserve(this->blockSize);
+}
+
+SeekableCompressWriter::~SeekableCompressWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch(IOException &)
+    {
+    }
+}
+
+void SeekableCompressWriter::writeHeader()
+{
+    if(wroteHeader)
+        return;
+    writer->writeBytes(SeekableLZ77Format::magic, sizeof(SeekableLZ77Format::magic));
+    writer->writeU8(SeekableLZ77Format::version);
+    compressedOffset = SeekableLZ77Format::headerSize;
+    wroteHeader = true;
+}
+
+void SeekableCompressWriter::startBlock()
+{
+    if(finished)
+        throw IOException("IO Error : write after finish");
+    blockTime = (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void SeekableCompressWriter::writeBlock()
+{
+    if(block.empty())
+        return;
+    writeHeader();
+    compressed.clear();
+    {
+        VectorWriter compressedWriter(compressed);
+        CompressWriter compressWriter(compressedWriter, level, format);
+        compressWriter.writeBytes(block.data(), block.size());
+        compressWriter.flush();
+    }
+    blocks.push_back(SeekableLZ77Format::Block{uncompressedOffset, compressedOffset, blockTime});
+    vector<uint8_t> header;
+    VectorWriter headerWriter(header);
+    headerWriter.writeVarU32((uint32_t)block.size());
+    headerWriter.writeVarU32((uint32_t)compressed.size());
+    headerWriter.writeVarU64(blockTime);
+    headerWriter.writeU32(crc32c(compressed.data(), compressed.size()));
+    writer->writeBytes(header.data(), header.size());
+    writer->writeBytes(compressed.data(), compressed.size());
+    uncompressedOffset += block.size();
+    compressedOffset += header.size() + compressed.size();
+    block.clear();
+}
+
+void SeekableCompressWriter::writeBytes(const uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(block.empty())
+            startBlock();
+        size_t currentCount = min(count, blockSize - block.size());
+        block.insert(block.end(), array, array + currentCount);
+        array += currentCount;
+        count -= currentCount;
+        if(block.size() >= blockSize)
+            writeBlock();
+    }
+}
+
+void SeekableCompressWriter::flush()
+{
+    writeBlock();
+    writer->flush();
+}
+
+void SeekableCompressWriter::finish()
+{
+    if(finished)
+        return;
+    finished = true;
+    writeBlock();
+    writeHeader();
+    writer->writeVarU32(0);
+    compressedOffset++;
+    vector<uint8_t> index;
+    VectorWriter indexWriter(index);
+    indexWriter.writeVarU32((uint32_t)blocks.size());
+    uint64_t previousTime = 0;
+    for(size_t i = 0; i < blocks.size(); i++)
+    {
+        uint64_t nextUncompressedOffset = i + 1 < blocks.size() ? blocks[i + 1].uncompressedOffset : uncompressedOffset;
+        uint64_t nextCompressedOffset = i + 1 < blocks.size() ? blocks[i + 1].compressedOffset : compressedOffset - 1;
+        indexWriter.writeVarU64(nextUncompressedOffset - blocks[i].uncompressedOffset);
+        indexWriter.writeVarU64(nextCompressedOffset - blocks[i].compressedOffset);
+        indexWriter.writeVarS64((int64_t)(blocks[i].time - previousTime));
+        previousTime = blocks[i].time;
+    }
+    writer->writeBytes(index.data(), index.size());
+    writer->writeU64(compressedOffset);
+    writer->writeU32(crc32c(index.data(), index.size()));
+    writer->writeBytes(SeekableLZ77Format::indexMagic, sizeof(SeekableLZ77Format::indexMagic));
+    writer->flush();
+}
+
+SeekableExpandReader::SeekableExpandReader(shared_ptr<SeekableReader> reader)
+    : reader(reader)
+{
+    reader->seek(0);
+    uint8_t magic[sizeof(SeekableLZ77Format::magic)];
+    try
+    {
+        reader->readBytes(magic, sizeof(magic));
+        if(0 != memcmp((const void *)magic, (const void *)SeekableLZ77Format::magic, sizeof(magic)))
+            throw InvalidDataValueException("not a seekable LZ77 stream");
+        if(reader->readU8() != SeekableLZ77Format::version)
+            throw InvalidDataValueException("unsupported seekable LZ77 version");
+    }
+    catch(EOFException &)
+    {
+        throw InvalidDataValueException("not a seekable LZ77 stream");
+    }
+    if(!readIndex())
+        scanBlocks();
+}
+
+SeekableExpandReader::~SeekableExpandReader()
+{
+}
+
+bool SeekableExpandReader::readIndex()
+{
+    uint64_t fileSize = reader->size();
+    if(fileSize < SeekableLZ77Format::headerSize + 1 + SeekableLZ77Format::trailerSize)
+        return false;
+    try
+    {
+        reader->seek(fileSize - SeekableLZ77Format::trailerSize);
+        uint64_t indexOffset = reader->readU64();
+        uint32_t indexCRC = reader->readU32();
+        uint8_t magic[sizeof(SeekableLZ77Format::indexMagic)];
+        reader->readBytes(magic, sizeof(magic));
+        if(0 != memcmp((const void *)magic, (const void *)SeekableLZ77Format::indexMagic, sizeof(magic)))
+            return false;
+        if(indexOffset < SeekableLZ77Format::headerSize + 1 || indexOffset > fileSize - SeekableLZ77Format::trailerSize)
+            return false;
+        shared_ptr<vector<uint8_t>> index = make_shared<vector<uint8_t>>((size_t)(fileSize - SeekableLZ77Format::trailerSize - indexOffset));
+        reader->seek(indexOffset);
+        reader->readBytes(index->data(), index->size());
+        if(crc32c(index->data(), index->size()) != indexCRC)
+            return false;
+        MemoryReader indexReader(shared_ptr<const uint8_t>(index, index->data()), index->size());
+        size_t blockCount = indexReader.readVarU32();
+        if(blockCount > index->size() / 3) // each block takes at least 3 bytes
+            return false;
+        vector<SeekableLZ77Format::Block> blocks;
+        blocks.reserve(blockCount);
+        uint64_t uncompressedOffset = 0, compressedOffset = SeekableLZ77Format::headerSize, time = 0;
+        for(size_t i = 0; i < blockCount; i++)
+        {
+            uint64_t size = indexReader.readVarU64();
+            uint64_t compressedSize = indexReader.readVarU64();
+            time += (uint64_t)indexReader.readVarS64();
+            if(size == 0 || size > SeekableLZ77Format::maxBlockSize || compressedSize > indexOffset - compressedOffset)
+                return false;
+            blocks.push_back(SeekableLZ77Format::Block{uncompressedOffset, compressedOffset, time});
+            uncompressedOffset += size;
+            compressedOffset += compressedSize;
+        }
+        if(indexReader.tell() != index->size() || compressedOffset + 1 != indexOffset) // the blocks and the end mark must fill the space before the index
+            return false;
+        this->blocks = move(blocks);
+        totalSize = uncompressedOffset;
+        return true;
+    }
+    catch(EOFException &)
+    {
+        return false;
+    }
+    catch(InvalidDataValueException &)
+    {
+        return false;
+    }
+}
+
+void SeekableExpandReader::scanBlocks()
+{
+    uint64_t fileSize = reader->size();
+    uint64_t offset = SeekableLZ77Format::headerSize;
+    try
+    {
+        while(true)
+        {
+            reader->seek(offset);
+            size_t size = reader->readVarU32();
+            if(size == 0)
+                break;
+            size_t compressedSize = reader->readVarU32();
+            uint64_t time = reader->readVarU64();
+            reader->readU32();
+            uint64_t compressedStart = reader->tell();
+            if(size > SeekableLZ77Format::maxBlockSize || compressedSize > SeekableLZ77Format::maxCompressedBlockSize)
+                break;
+            if(compressedSize > fileSize - compressedStart) // the last block was cut off
+                break;
+            blocks.push_back(SeekableLZ77Format::Block{totalSize, offset, time});
+            totalSize += size;
+            offset = compressedStart + compressedSize;
+        }
+    }
+    catch(EOFException &)
+    {
+    }
+    catch(InvalidDataValueException &)
+    {
+    }
+}
+
+size_t SeekableExpandReader::findBlock(uint64_t offset) const
+{
+    assert(offset < totalSize);
+    auto iter = upper_bound(blocks.begin(), blocks.end(), offset, [](uint64_t offset, const SeekableLZ77Format::Block & block)
+    {
+        return offset < block.uncompressedOffset;
+    });
+    return (size_t)(iter - blocks.begin()) - 1;
+}
+
+void SeekableExpandReader::expandBlock(size_t index)
+{
+    uint64_t size = (index + 1 < blocks.size() ? blocks[index + 1].uncompressedOffset : totalSize) - blocks[index].uncompressedOffset;
+    block.clear();
+    blockOffset = 0;
+    shared_ptr<vector<uint8_t>> compressed;
+    try
+    {
+        reader->seek(blocks[index].compressedOffset);
+        if(reader->readVarU32() != size)
+            throw LZ77FormatException();
+        size_t compressedSize = reader->readVarU32();
+        if(compressedSize > SeekableLZ77Format::maxCompressedBlockSize)
+            throw LZ77FormatException();
+        reader->readVarU64();
+        uint32_t crc = reader->readU32();
+        compressed = make_shared<vector<uint8_t>>(compressedSize);
+        reader->readBytes(compressed->data(), compressedSize);
+        if(crc32c(compressed->data(), compressedSize) != crc)
+            throw LZ77FormatException();
+    }
+    catch(EOFException &)
+    {
+        throw LZ77FormatException();
+    }
+    catch(InvalidDataValueException &)
+    {
+        throw LZ77FormatException();
+    }
+    vector<uint8_t> expanded((size_t)size);
+    ExpandReader expandReader(make_shared<MemoryReader>(shared_ptr<const uint8_t>(compressed, compressed->data()), compressed->size()));
+    try
+    {
+        expandReader.readBytes(expanded.data(), expanded.size());
+    }
+    catch(EOFException &)
+    {
+        throw LZ77FormatException();
+    }
+    block = move(expanded);
+    blockIndex = index;
+}
+
+void SeekableExpandReader::fill()
+{
+    if(position >= totalSize)
+        throw EOFException();
+    expandBlock(findBlock(position));
+    blockOffset = (size_t)(position - blocks[blockIndex].uncompressedOffset);
+}
+
+void SeekableExpandReader::readBytes(uint8_t * array, size_t count)
+{
+    while(count > 0)
+    {
+        if(blockOffset >= block.size())
+            fill();
+        size_t currentCount = min(count, block.size() - blockOffset);
+        memcpy((void *)array, (const void *)&block[blockOffset], currentCount);
+        blockOffset += currentCount;
+        position += currentCount;
+        array += currentCount;
+        count -= currentCount;
+    }
+}
+
+void SeekableExpandReader::seek(uint64_t offset)
+{
+    if(offset > totalSize)
+        throw IOException("IO Error : seek past the end");
+    position = offset;
+    if(!block.empty() && offset >= blocks[blockIndex].uncompressedOffset && offset - blocks[blockIndex].uncompressedOffset < block.size())
+    {
+        blockOffset = (size_t)(offset - blocks[blockIndex].uncompressedOffset);
+        return;
+    }
+    block.clear();
+    blockOffset = 0;
+}
+
+uint64_t SeekableExpandReader::seekToTime(uint64_t time)
+{
+    auto iter = upper_bound(blocks.begin(), blocks.end(), time, [](uint64_t time, const SeekableLZ77Format::Block & block)
+    {
+        return time < block.time;
+    });
+    uint64_t offset = iter == blocks.begin() ? 0 : (iter - 1)->uncompressedOffset;
+    seek(offset);
+    return offset;
+}
@@ -0,0 +1,164 @@
+#ifndef SEEKABLE_COMPRESSED_STREAM_H_INCLUDED
+#define SEEKABLE_COMPRESSED_STREAM_H_INCLUDED
+
+#include "compressed_stream.h"
+
+// seekable LZ77 format :
+// 4 byte magic number ("LZSK")
+// U8 version
+// blocks :
+//   VarU32 uncompressed size (never 0)
+//   VarU32 compressed size
+//   VarU64 time of the first byte of the block in microseconds since the unix epoch
+//   U32 CRC-32C of the compressed bytes
+//   a complete CompressWriter stream of the block, blocks don't refer to each other so they can be expanded in any order
+// VarU32 0 to end the blocks
+// the index :
+//   VarU32 block count
+//   for each block :
+//     VarU64 uncompressed size
+//     VarU64 size of the block including its header
+//     VarS64 time minus the time of the previous block (or minus 0 for the first block)
+// the trailer :
+//   U64 offset of the index
+//   U32 CRC-32C of the index
+//   4 byte magic number ("LZSI")
+// a stream without a valid trailer (a recording that was cut off) is read by scanning the block headers
+
+struct SeekableLZ77Format final
+{
+    static constexpr uint8_t magic[4] = {'L', 'Z', 'S', 'K'};
+    static constexpr uint8_t indexMagic[4] = {'L', 'Z', 'S', 'I'};
+    static constexpr uint8_t version = 1;
+    static constexpr size_t headerSize = sizeof(magic) + 1;
+    static constexpr size_t trailerSize = 8 + 4 + sizeof(indexMagic);
+    static constexpr size_t maxBlockSize = (size_t)1 << 24;
+    static constexpr size_t maxCompressedBlockSize = 2 * LZ77LegacyGeometry::encodedSize * maxBlockSize; // legacy codes can expand literals
+    struct Block final
+    {
+        uint64_t uncompressedOffset;
+        uint64_t compressedOffset; // of the block header
+        uint64_t time; // microseconds since the unix epoch
+    };
+};
+
+/** compresses blocks of up to blockSize bytes on their own and writes an index of them at the end
+    so SeekableExpandReader can start reading at any offset or time by expanding only the block containing it<br/>
+    flush ends the current block, finish (or the destructor) writes the index
+ */
+class SeekableCompressWriter final : public Writer
+{
+public:
+    static constexpr size_t defaultBlockSize = (size_t)1 << 16;
+private:
+    shared_ptr<Writer> writer;
+    const size_t blockSize;
+    const int level;
+    const LZ77Format format;
+    vector<uint8_t> block; // the block being filled
+    uint64_t blockTime = 0;
+    vector<uint8_t> compressed;
+    vector<SeekableLZ77Format::Block> blocks;
+    uint64_t uncompressedOffset = 0, compressedOffset = 0;
+    bool wroteHeader = false, finished = false;
+    void writeHeader();
+    void startBlock();
+    void writeBlock();
+public:
+    explicit SeekableCompressWriter(shared_ptr<Writer> writer, size_t blockSize = defaultBlockSize, int level = CompressWriter::defaultLevel,
+                                    LZ77Format format = LZ77Format::Entropy);
+    explicit SeekableCompressWriter(Writer & writer, size_t blockSize = defaultBlockSize, int level = CompressWriter::defaultLevel,
+                                    LZ77Format format = LZ77Format::Entropy)
+        : SeekableCompressWriter(shared_ptr<Writer>(&writer, [](Writer *){}), blockSize, level, format)
+    {
+    }
+    virtual ~SeekableCompressWriter();
+    virtual void writeByte(uint8_t v) override
+    {
+        if(block.empty())
+            startBlock();
+        block.push_back(v);
+        if(block.size() >= blockSize)
+            writeBlock();
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override;
+    virtual void flush() override;
+    /** writes the last block, the index and the trailer, nothing can be written after this
+     */
+    void finish();
+};
+
+/** reads the format written by SeekableCompressWriter<br/>
+    seeking finds the block in the index with a binary search and expands it when it is read,
+    so reading from the middle of a long stream only expands the blocks that are read
+ */
+class SeekableExpandReader final : public SeekableReader
+{
+private:
+    shared_ptr<SeekableReader> reader;
+    vector<SeekableLZ77Format::Block> blocks;
+    uint64_t totalSize = 0;
+    uint64_t position = 0;
+    size_t blockIndex = 0; // of the expanded block
+    vector<uint8_t> block; // the expanded block, empty if none is expanded
+    size_t blockOffset = 0; // of position in block when position is in block
+    bool readIndex();
+    void scanBlocks();
+    size_t findBlock(uint64_t offset) const;
+    void expandBlock(size_t index);
+    void fill();
+public:
+    /** @throws InvalidDataValueException if reader isn't a seekable LZ77 stream
+     */
+    explicit SeekableExpandReader(shared_ptr<SeekableReader> reader);
+    explicit SeekableExpandReader(SeekableReader & reader)
+        : SeekableExpandReader(shared_ptr<SeekableReader>(&reader, [](SeekableReader *){}))
+    {
+    }
+    virtual ~SeekableExpandReader();
+    virtual uint8_t readByte() override
+    {
+        if(blockOffset >= block.size())
+            fill();
+        position++;
+        return block[blockOffset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override;
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = block.size() - blockOffset;
+        if(available == 0)
+            return nullptr;
+        return &block[blockOffset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= block.size() - blockOffset);
+        blockOffset += count;
+        position += count;
+    }
+    virtual uint64_t size() override
+    {
+        return totalSize;
+    }
+    virtual uint64_t tell() override
+    {
+        return position;
+    }
+    virtual void seek(uint64_t offset) override;
+    /** seek to the start of the last block written at or before time, or to the start of the stream if every block is after it
+        @param time microseconds since the unix epoch
+        @return the new offset
+     */
+    uint64_t seekToTime(uint64_t time);
+    size_t getBlockCount() const
+    {
+        return blocks.size();
+    }
+    const SeekableLZ77Format::Block & getBlock(size_t index) const
+    {
+        return blocks[index];
+    }
+};
+
+#endif // SEEKABLE_COMPRESSED_STREAM_H_INCLUDED
@@ -42,7 +42,7 @@ public:
     SerialReader(wstring fileName, int baud = 9600)
     {
         string str = wstringToString(fileName);
-        fd = open(str.c_str(), O_RDONLY | O_NOCTTY);
+        fd = open(str.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK); // non-blocking so reads only poll when there's nothing to read
         if(fd == -1)
         {
             throw IOException(string("IO Error : ") + strerror(errno));
@@ -70,16 +70,39 @@ public:
     {
         close(fd);
     }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        return waitFdReadable(fd, deadline, cancellationToken);
+    }
     virtual uint8_t readByte() override
     {
         uint8_t retval;
         static_assert(sizeof(uint8_t) == 1, "sizeof(uint8_t) == 1 failed");
-        ssize_t v = read(fd, (void *)&retval, 1);
-        if(v == 1)
-            return retval;
-        if(v == 0)
-            throw EOFException();
-        throw IOException(string("IO Error : ") + strerror(errno));
+        readBytes(&retval, 1);
+        return retval;
+    }
+    /** each read returns as much of count as is available
+     */
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        if(cancellationToken)
+            cancellationToken->check();
+        while(count > 0)
+        {
+            ssize_t v = read(fd, (void *)array, count);
+            if(v > 0)
+            {
+                array += v;
+                count -= v;
+                continue;
+            }
+            if(v == 0)
+                throw EOFException();
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                waitFdReadable(fd, StreamClock::time_point::max(), cancellationToken);
+            else if(errno != EINTR)
+                throw IOException(string("IO Error : ") + strerror(errno));
+        }
     }
 };
 
@@ -90,7 +113,7 @@ public:
     SerialWriter(wstring fileName, int baud = 9600)
     {
         string str = wstringToString(fileName);
-        fd = open(str.c_str(), O_WRONLY | O_NOCTTY);
+        fd = open(str.c_str(), O_WRONLY | O_NOCTTY | O_NONBLOCK); // non-blocking so writes only poll when the port's buffer is full
         if(fd == -1)
         {
             throw IOException(string("IO Error : ") + strerror(errno));
@@ -121,13 +144,17 @@ public:
     virtual void writeByte(uint8_t byte) override
     {
         static_assert(sizeof(uint8_t) == 1, "sizeof(uint8_t) == 1 failed");
-        ssize_t v = write(fd, (const void *)&byte, 1);
-        if(v == 1)
-            return;
-        int errno_value = ENOSPC;
-        if(v == -1)
-            errno_value = errno;
-        throw IOException(string("IO Error : ") + strerror(errno_value));
+        IOVector vector(&byte, 1);
+        writeFdVectored(fd, &vector, 1, cancellationToken);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        IOVector vector(array, count);
+        writeFdVectored(fd, &vector, 1, cancellationToken);
+    }
+    virtual void writeVectored(const IOVector * vectors, size_t count) override
+    {
+        writeFdVectored(fd, vectors, count, cancellationToken);
     }
     virtual void flush() override
     {
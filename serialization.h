@@ -0,0 +1,365 @@
+#ifndef SERIALIZATION_H_INCLUDED
+#define SERIALIZATION_H_INCLUDED
+
+#include "stream.h"
+#include <type_traits>
+
+// compile time serialization of structs
+//
+// describe the fields once :
+//
+// struct Command
+// {
+//     uint8_t channel;
+//     float value;
+//     wstring label;
+// };
+//
+// typedef Serializer<Command,
+//                    SERIALIZED_LIMITED_FIELD(Command, channel, WireU8, 1, 5),
+//                    SERIALIZED_FIELD_CHECKED(Command, value, WireF32, FiniteCheck),
+//                    SERIALIZED_FIELD(Command, label, WireString)> CommandSerializer;
+//
+// CommandSerializer::write(writer, command);
+// Command command = CommandSerializer::read(reader);
+//
+// the size of the leading fixed size fields is computed at compile time and they are
+// encoded into one buffer and written with one writeBytes call or decoded straight out of
+// the reader's buffer (see Reader::peekBuffered) when there are enough bytes buffered.
+// the byte layout is the same as the Reader/Writer functions.
+
+namespace serialization_internal
+{
+template <typename T, size_t byteCount>
+struct BigEndian final
+{
+    static void encode(uint8_t * p, T v)
+    {
+        typedef typename make_unsigned<T>::type U;
+        U u = (U)v;
+        for(size_t i = 0; i < byteCount; i++)
+            p[i] = (uint8_t)(u >> (8 * (byteCount - 1 - i)));
+    }
+    static T decode(const uint8_t * p)
+    {
+        typedef typename make_unsigned<T>::type U;
+        U u = 0;
+        for(size_t i = 0; i < byteCount; i++)
+            u = (U)((u << 8) | p[i]);
+        return (T)u;
+    }
+};
+}
+
+// wire formats : fixed formats have size bytes and encode/decode, all formats have write/read
+
+template <typename T, T (Reader::*readFn)(), void (Writer::*writeFn)(T)>
+struct WireFixedInt final
+{
+    typedef T type;
+    static constexpr bool fixed = true;
+    static constexpr size_t size = sizeof(T);
+    static void encode(uint8_t * p, T v)
+    {
+        serialization_internal::BigEndian<T, sizeof(T)>::encode(p, v);
+    }
+    static T decode(const uint8_t * p)
+    {
+        return serialization_internal::BigEndian<T, sizeof(T)>::decode(p);
+    }
+    static void write(Writer & writer, T v)
+    {
+        (writer.*writeFn)(v);
+    }
+    static T read(Reader & reader)
+    {
+        return (reader.*readFn)();
+    }
+};
+
+typedef WireFixedInt<uint8_t, &Reader::readU8, &Writer::writeU8> WireU8;
+typedef WireFixedInt<int8_t, &Reader::readS8, &Writer::writeS8> WireS8;
+typedef WireFixedInt<uint16_t, &Reader::readU16, &Writer::writeU16> WireU16;
+typedef WireFixedInt<int16_t, &Reader::readS16, &Writer::writeS16> WireS16;
+typedef WireFixedInt<uint32_t, &Reader::readU32, &Writer::writeU32> WireU32;
+typedef WireFixedInt<int32_t, &Reader::readS32, &Writer::writeS32> WireS32;
+typedef WireFixedInt<uint64_t, &Reader::readU64, &Writer::writeU64> WireU64;
+typedef WireFixedInt<int64_t, &Reader::readS64, &Writer::writeS64> WireS64;
+
+template <typename T, typename I>
+struct WireFloat final
+{
+    static_assert(sizeof(T) == sizeof(I), "float size mismatch");
+    typedef T type;
+    static constexpr bool fixed = true;
+    static constexpr size_t size = sizeof(T);
+    static void encode(uint8_t * p, T v)
+    {
+        I i;
+        memcpy((void *)&i, (const void *)&v, sizeof(i));
+        serialization_internal::BigEndian<I, sizeof(I)>::encode(p, i);
+    }
+    static T decode(const uint8_t * p)
+    {
+        I i = serialization_internal::BigEndian<I, sizeof(I)>::decode(p);
+        T v;
+        memcpy((void *)&v, (const void *)&i, sizeof(v));
+        return v;
+    }
+    static void write(Writer & writer, T v)
+    {
+        uint8_t bytes[size];
+        encode(bytes, v);
+        writer.writeBytes(bytes, size);
+    }
+    static T read(Reader & reader)
+    {
+        uint8_t bytes[size];
+        reader.readBytes(bytes, size);
+        return decode(bytes);
+    }
+};
+
+typedef WireFloat<float, uint32_t> WireF32;
+typedef WireFloat<double, uint64_t> WireF64;
+
+struct WireBool final
+{
+    typedef bool type;
+    static constexpr bool fixed = true;
+    static constexpr size_t size = 1;
+    static void encode(uint8_t * p, bool v)
+    {
+        *p = v ? 1 : 0;
+    }
+    static bool decode(const uint8_t * p)
+    {
+        return *p != 0;
+    }
+    static void write(Writer & writer, bool v)
+    {
+        writer.writeBool(v);
+    }
+    static bool read(Reader & reader)
+    {
+        return reader.readBool();
+    }
+};
+
+template <typename T, T (Reader::*readFn)(), void (Writer::*writeFn)(T)>
+struct WireVariable final
+{
+    typedef T type;
+    static constexpr bool fixed = false;
+    static constexpr size_t size = 0;
+    static void encode(uint8_t *, T)
+    {
+        assert(false);
+    }
+    static T decode(const uint8_t *)
+    {
+        assert(false);
+        return T();
+    }
+    static void write(Writer & writer, T v)
+    {
+        (writer.*writeFn)(v);
+    }
+    static T read(Reader & reader)
+    {
+        return (reader.*readFn)();
+    }
+};
+
+typedef WireVariable<uint32_t, &Reader::readVarU32, &Writer::writeVarU32> WireVarU32;
+typedef WireVariable<int32_t, &Reader::readVarS32, &Writer::writeVarS32> WireVarS32;
+typedef WireVariable<uint64_t, &Reader::readVarU64, &Writer::writeVarU64> WireVarU64;
+typedef WireVariable<int64_t, &Reader::readVarS64, &Writer::writeVarS64> WireVarS64;
+typedef WireVariable<wstring, &Reader::readString, &Writer::writeString> WireString;
+
+// validation run on each field after it's read
+
+struct NoCheck final
+{
+    template <typename T>
+    static T check(T v)
+    {
+        return v;
+    }
+};
+
+template <typename T, T min, T max>
+struct LimitCheck final // same as Reader::readLimited*
+{
+    static T check(T v)
+    {
+        return Reader::limitAfterRead(v, min, max);
+    }
+};
+
+struct FiniteCheck final // same as Reader::readFinite*
+{
+    template <typename T>
+    static T check(T v)
+    {
+        return Reader::finiteAfterRead(v);
+    }
+};
+
+template <long long min, long long max>
+struct FiniteLimitCheck final // same as Reader::readLimitedF32/F64 with integer limits
+{
+    template <typename T>
+    static T check(T v)
+    {
+        return Reader::limitAfterRead<T>(Reader::finiteAfterRead(v), (T)min, (T)max);
+    }
+};
+
+template <typename Class, typename MemberType, MemberType Class::*member, typename Wire, typename Check = NoCheck>
+struct SerializedField final
+{
+    static constexpr bool fixed = Wire::fixed;
+    static constexpr size_t size = Wire::size;
+    static void encode(const Class & v, uint8_t * p)
+    {
+        Wire::encode(p, (typename Wire::type)(v.*member));
+    }
+    static void decode(Class & v, const uint8_t * p)
+    {
+        v.*member = (MemberType)Check::check(Wire::decode(p));
+    }
+    static void write(Writer & writer, const Class & v)
+    {
+        Wire::write(writer, (typename Wire::type)(v.*member));
+    }
+    static void read(Reader & reader, Class & v)
+    {
+        v.*member = (MemberType)Check::check(Wire::read(reader));
+    }
+};
+
+#define SERIALIZED_FIELD(Class, member, Wire) SerializedField<Class, decltype(Class::member), &Class::member, Wire>
+#define SERIALIZED_FIELD_CHECKED(Class, member, Wire, ...) SerializedField<Class, decltype(Class::member), &Class::member, Wire, __VA_ARGS__>
+#define SERIALIZED_LIMITED_FIELD(Class, member, Wire, min, max) SerializedField<Class, decltype(Class::member), &Class::member, Wire, LimitCheck<typename Wire::type, min, max>>
+
+namespace serialization_internal
+{
+template <typename Class, bool inPrefix, typename ...Fields>
+struct FieldList;
+
+template <typename Class, bool inPrefix>
+struct FieldList<Class, inPrefix> final
+{
+    static constexpr size_t prefixSize = 0;
+    static void encodePrefix(const Class &, uint8_t *)
+    {
+    }
+    static void decodePrefix(Class &, const uint8_t *)
+    {
+    }
+    static void writeRest(Writer &, const Class &)
+    {
+    }
+    static void readRest(Reader &, Class &)
+    {
+    }
+};
+
+template <typename Class, bool inPrefix, typename First, typename ...Rest>
+struct FieldList<Class, inPrefix, First, Rest...> final
+{
+    static constexpr bool firstInPrefix = inPrefix && First::fixed;
+    typedef FieldList<Class, firstInPrefix, Rest...> RestList;
+    static constexpr size_t prefixSize = (firstInPrefix ? First::size : 0) + RestList::prefixSize;
+    static void encodePrefix(const Class & v, uint8_t * p)
+    {
+        if(firstInPrefix)
+        {
+            First::encode(v, p);
+            RestList::encodePrefix(v, p + First::size);
+        }
+    }
+    static void decodePrefix(Class & v, const uint8_t * p)
+    {
+        if(firstInPrefix)
+        {
+            First::decode(v, p);
+            RestList::decodePrefix(v, p + First::size);
+        }
+    }
+    static void writeRest(Writer & writer, const Class & v)
+    {
+        if(!firstInPrefix)
+            First::write(writer, v);
+        RestList::writeRest(writer, v);
+    }
+    static void readRest(Reader & reader, Class & v)
+    {
+        if(!firstInPrefix)
+            First::read(reader, v);
+        RestList::readRest(reader, v);
+    }
+};
+}
+
+template <typename Class, typename ...Fields>
+struct Serializer final
+{
+private:
+    typedef serialization_internal::FieldList<Class, true, Fields...> List;
+public:
+    /** the size of the leading fixed size fields
+     */
+    static constexpr size_t prefixSize = List::prefixSize;
+    static void write(Writer & writer, const Class & v)
+    {
+        if(prefixSize > 0)
+        {
+            uint8_t bytes[prefixSize > 0 ? prefixSize : 1];
+            List::encodePrefix(v, bytes);
+            writer.writeBytes(bytes, prefixSize);
+        }
+        List::writeRest(writer, v);
+    }
+    static void read(Reader & reader, Class & v)
+    {
+        if(prefixSize > 0)
+        {
+            size_t available;
+            const uint8_t * p = reader.peekBuffered(available);
+            if(available >= prefixSize)
+            {
+                List::decodePrefix(v, p);
+                reader.skipBuffered(prefixSize);
+            }
+            else
+            {
+                uint8_t bytes[prefixSize > 0 ? prefixSize : 1];
+                reader.readBytes(bytes, prefixSize);
+                List::decodePrefix(v, bytes);
+            }
+        }
+        List::readRest(reader, v);
+    }
+    static Class read(Reader & reader)
+    {
+        Class retval;
+        read(reader, retval);
+        return retval;
+    }
+    /** encode a struct with only fixed size fields into p
+     */
+    static void encode(const Class & v, uint8_t * p)
+    {
+        List::encodePrefix(v, p);
+    }
+    /** decode a struct with only fixed size fields from p
+     */
+    static void decode(Class & v, const uint8_t * p)
+    {
+        List::decodePrefix(v, p);
+    }
+};
+
+#endif // SERIALIZATION_H_INCLUDED
@@ -1,10 +1,19 @@
 #include "stream.h"
+#include "buffer_pool.h"
+#include "util.h"
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
 #include <iostream>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <algorithm>
 
 using namespace std;
 
@@ -14,16 +23,67 @@ const size_t bufferSize = 8192;
 
 struct Pipe
 {
+    struct Chunk
+    {
+        IOBuffer buffer;
+        size_t size = 0;
+    };
     mutex lock;
     condition_variable_any cond;
     bool closed = false;
-    queue<uint8_t> buffer;
+    circularDeque<Chunk, 4> chunks; // only the last chunk is partly filled and bufferedBytes never goes past bufferSize so there are at most 2
+    size_t bufferedBytes = 0;
 };
 
+static_assert(bufferSize <= IOBuffer::capacity, "pipe chunk queue too small");
+
 class PipeReader final : public Reader
 {
 private:
     shared_ptr<Pipe> pipe;
+    IOBuffer current; // the chunk taken from the pipe, owned by this reader so it can be read without locking
+    size_t currentStart = 0, currentEnd = 0;
+    CancellationToken::ListenerHandle listenerHandle;
+    void removeListener()
+    {
+        if(cancellationToken)
+            cancellationToken->removeListener(listenerHandle);
+    }
+    void nextChunk()
+    {
+        current.reset();
+        currentStart = currentEnd = 0;
+        pipe->lock.lock();
+        if(pipe->chunks.empty())
+        {
+            pipe->cond.notify_all();
+        }
+        while(true)
+        {
+            if(!pipe->chunks.empty())
+                break;
+            if(pipe->closed)
+            {
+                pipe->lock.unlock();
+                throw EOFException();
+            }
+            if(cancellationToken && cancellationToken->cancelled())
+            {
+                pipe->lock.unlock();
+                throw CancelledException();
+            }
+            pipe->cond.wait(pipe->lock);
+        }
+        Pipe::Chunk & chunk = pipe->chunks.front();
+        current = std::move(chunk.buffer);
+        currentEnd = chunk.size;
+        bool wasFull = pipe->bufferedBytes >= bufferSize;
+        pipe->bufferedBytes -= chunk.size;
+        pipe->chunks.pop_front();
+        if(wasFull)
+            pipe->cond.notify_all();
+        pipe->lock.unlock();
+    }
 public:
     PipeReader(shared_ptr<Pipe> pipe)
         : pipe(pipe)
@@ -31,33 +91,86 @@ public:
     }
     virtual ~PipeReader()
     {
+        removeListener();
         pipe->lock.lock();
         pipe->closed = true;
         pipe->cond.notify_all();
         pipe->lock.unlock();
     }
-    virtual uint8_t readByte() override
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
     {
-        pipe->lock.lock();
-        if(pipe->buffer.empty())
+        removeListener();
+        cancellationToken = token;
+        if(token)
         {
-            pipe->cond.notify_all();
+            shared_ptr<Pipe> pipe = this->pipe;
+            listenerHandle = token->addListener([pipe]()
+            {
+                pipe->lock.lock();
+                pipe->cond.notify_all();
+                pipe->lock.unlock();
+            });
+        }
+    }
+    virtual bool waitReadable(StreamClock::time_point deadline) override
+    {
+        if(currentStart < currentEnd)
+        {
+            if(cancellationToken)
+                cancellationToken->check();
+            return true;
         }
+        pipe->lock.lock();
         while(true)
         {
-            if(!pipe->buffer.empty())
+            if(cancellationToken && cancellationToken->cancelled())
+            {
+                pipe->lock.unlock();
+                throw CancelledException();
+            }
+            if(!pipe->chunks.empty() || pipe->closed)
                 break;
-            if(pipe->closed)
+            pipe->cond.notify_all();
+            if(pipe->cond.wait_until(pipe->lock, deadline) == cv_status::timeout)
             {
+                bool retval = !pipe->chunks.empty() || pipe->closed;
                 pipe->lock.unlock();
-                throw EOFException();
+                return retval;
             }
-            pipe->cond.wait(pipe->lock);
         }
-        uint8_t retval = pipe->buffer.front();
-        pipe->buffer.pop();
         pipe->lock.unlock();
-        return retval;
+        return true;
+    }
+    virtual uint8_t readByte() override
+    {
+        if(currentStart >= currentEnd)
+            nextChunk();
+        return current.data()[currentStart++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        while(count > 0)
+        {
+            if(currentStart >= currentEnd)
+                nextChunk();
+            size_t currentCount = min(count, currentEnd - currentStart);
+            memcpy((void *)array, (const void *)(current.data() + currentStart), currentCount);
+            currentStart += currentCount;
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = currentEnd - currentStart;
+        if(available == 0)
+            return nullptr;
+        return current.data() + currentStart;
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= currentEnd - currentStart);
+        currentStart += count;
     }
 };
 
@@ -65,6 +178,51 @@ class PipeWriter final : public Writer
 {
 private:
     shared_ptr<Pipe> pipe;
+    CancellationToken::ListenerHandle listenerHandle;
+    void removeListener()
+    {
+        if(cancellationToken)
+            cancellationToken->removeListener(listenerHandle);
+    }
+    size_t waitForSpace() // lock must be held, returns the number of bytes that can be written
+    {
+        while(true)
+        {
+            if(pipe->closed)
+            {
+                pipe->lock.unlock();
+                throw IOException("IO Error : can't write to pipe");
+            }
+            if(cancellationToken && cancellationToken->cancelled())
+            {
+                pipe->lock.unlock();
+                throw CancelledException();
+            }
+            if(pipe->bufferedBytes < bufferSize)
+                return bufferSize - pipe->bufferedBytes;
+            pipe->cond.notify_all();
+            pipe->cond.wait(pipe->lock);
+        }
+    }
+    void append(const uint8_t * array, size_t count) // lock must be held and there must be space for count bytes
+    {
+        while(count > 0)
+        {
+            if(pipe->chunks.empty() || pipe->chunks.back().size >= IOBuffer::capacity)
+            {
+                Pipe::Chunk chunk;
+                chunk.buffer = IOBuffer::allocate();
+                pipe->chunks.push_back(std::move(chunk));
+            }
+            Pipe::Chunk & chunk = pipe->chunks.back();
+            size_t currentCount = min(count, IOBuffer::capacity - chunk.size);
+            memcpy((void *)(chunk.buffer.data() + chunk.size), (const void *)array, currentCount);
+            chunk.size += currentCount;
+            pipe->bufferedBytes += currentCount;
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
 public:
     PipeWriter(shared_ptr<Pipe> pipe)
         : pipe(pipe)
@@ -73,28 +231,71 @@ public:
 
     virtual ~PipeWriter()
     {
+        removeListener();
         pipe->lock.lock();
         pipe->closed = true;
         pipe->cond.notify_all();
         pipe->lock.unlock();
     }
 
-    virtual void writeByte(uint8_t v) override
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token) override
+    {
+        removeListener();
+        cancellationToken = token;
+        if(token)
+        {
+            shared_ptr<Pipe> pipe = this->pipe;
+            listenerHandle = token->addListener([pipe]()
+            {
+                pipe->lock.lock();
+                pipe->cond.notify_all();
+                pipe->lock.unlock();
+            });
+        }
+    }
+
+    virtual bool waitWritable(StreamClock::time_point deadline) override
     {
         pipe->lock.lock();
         while(true)
         {
-            if(pipe->closed)
+            if(cancellationToken && cancellationToken->cancelled())
             {
                 pipe->lock.unlock();
-                throw IOException("IO Error : can't write to pipe");
+                throw CancelledException();
             }
-            if(pipe->buffer.size() < bufferSize)
+            if(pipe->bufferedBytes < bufferSize || pipe->closed)
                 break;
             pipe->cond.notify_all();
-            pipe->cond.wait(pipe->lock);
+            if(pipe->cond.wait_until(pipe->lock, deadline) == cv_status::timeout)
+            {
+                bool retval = pipe->bufferedBytes < bufferSize || pipe->closed;
+                pipe->lock.unlock();
+                return retval;
+            }
+        }
+        pipe->lock.unlock();
+        return true;
+    }
+
+    virtual void writeByte(uint8_t v) override
+    {
+        pipe->lock.lock();
+        waitForSpace();
+        append(&v, 1);
+        pipe->lock.unlock();
+    }
+
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        pipe->lock.lock();
+        while(count > 0)
+        {
+            size_t currentCount = min(count, waitForSpace());
+            append(array, currentCount);
+            array += currentCount;
+            count -= currentCount;
         }
-        pipe->buffer.push(v);
         pipe->lock.unlock();
     }
 
@@ -114,9 +315,243 @@ StreamPipe::StreamPipe()
     writerInternal = shared_ptr<Writer>(new PipeWriter(pipe));
 }
 
+CancellationToken::CancellationToken()
+    : cancelledInternal(false)
+{
+    if(0 != ::pipe(pipeFds))
+        throw IOException(string("IO Error : ") + strerror(errno));
+}
+
+CancellationToken::~CancellationToken()
+{
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+void CancellationToken::cancel()
+{
+    list<function<void()>> fns;
+    lock.lock();
+    if(cancelledInternal)
+    {
+        lock.unlock();
+        return;
+    }
+    cancelledInternal = true;
+    fns = listeners;
+    uint8_t v = 0;
+    while(-1 == write(pipeFds[1], (const void *)&v, 1) && errno == EINTR)
+    {
+    }
+    lock.unlock();
+    for(function<void()> & fn : fns)
+        fn();
+}
+
+CancellationToken::ListenerHandle CancellationToken::addListener(function<void()> fn)
+{
+    lock.lock();
+    ListenerHandle retval = listeners.insert(listeners.end(), fn);
+    bool callNow = cancelledInternal;
+    lock.unlock();
+    if(callNow)
+        fn();
+    return retval;
+}
+
+void CancellationToken::removeListener(ListenerHandle handle)
+{
+    lock.lock();
+    listeners.erase(handle);
+    lock.unlock();
+}
+
+namespace
+{
+bool waitFd(int fd, short events, StreamClock::time_point deadline, shared_ptr<CancellationToken> token)
+{
+    while(true)
+    {
+        if(token)
+            token->check();
+        pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = events;
+        fds[0].revents = 0;
+        nfds_t fdCount = 1;
+        if(token)
+        {
+            fds[1].fd = token->waitFd();
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            fdCount = 2;
+        }
+        int timeout = -1;
+        if(deadline != StreamClock::time_point::max())
+        {
+            StreamClock::time_point now = StreamClock::now();
+            if(deadline <= now)
+                timeout = 0;
+            else
+            {
+                auto ms = chrono::duration_cast<chrono::milliseconds>(deadline - now + chrono::milliseconds(1) - StreamClock::duration(1)).count();
+                timeout = (int)limit<decltype(ms)>(ms, 0, 0x7FFFFFFF);
+            }
+        }
+        int retval = poll(fds, fdCount, timeout);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            throw IOException(string("IO Error : ") + strerror(errno));
+        }
+        if(token)
+            token->check();
+        if(retval > 0 && fds[0].revents != 0) // ready, hung up or error : let the read or write report it
+            return true;
+        if(timeout != -1 && StreamClock::now() >= deadline)
+            return false;
+    }
+}
+}
+
+bool waitFdReadable(int fd, StreamClock::time_point deadline, shared_ptr<CancellationToken> token)
+{
+    return waitFd(fd, POLLIN, deadline, token);
+}
+
+bool waitFdWritable(int fd, StreamClock::time_point deadline, shared_ptr<CancellationToken> token)
+{
+    return waitFd(fd, POLLOUT, deadline, token);
+}
+
+void writeFdVectored(int fd, const IOVector * vectors, size_t count, shared_ptr<CancellationToken> token)
+{
+#ifdef IOV_MAX
+    const size_t maxVectorCount = IOV_MAX;
+#else
+    const size_t maxVectorCount = 16;
+#endif
+    static_assert(sizeof(uint8_t) == 1, "sizeof(uint8_t) == 1 failed");
+    iovec iov[64];
+    size_t firstVector = 0, firstVectorOffset = 0;
+    bool wait = false; // writev is tried first and only waited for when the fd is full so most writes are one system call
+    if(token)
+        token->check();
+    while(true)
+    {
+        while(firstVector < count && firstVectorOffset >= vectors[firstVector].size)
+        {
+            firstVector++;
+            firstVectorOffset = 0;
+        }
+        if(firstVector >= count)
+            return;
+        size_t iovCount = 0, requested = 0;
+        for(size_t i = firstVector; i < count && iovCount < maxVectorCount && iovCount < sizeof(iov) / sizeof(iov[0]); i++)
+        {
+            size_t offset = (i == firstVector) ? firstVectorOffset : 0;
+            if(vectors[i].size <= offset)
+                continue;
+            iov[iovCount].iov_base = (void *)(vectors[i].data + offset);
+            iov[iovCount].iov_len = vectors[i].size - offset;
+            requested += iov[iovCount].iov_len;
+            iovCount++;
+        }
+        if(wait)
+            waitFdWritable(fd, StreamClock::time_point::max(), token);
+        wait = false;
+        ssize_t retval = writev(fd, iov, iovCount);
+        if(retval == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                wait = true;
+            else if(errno != EINTR)
+                throw IOException(string("IO Error : ") + strerror(errno));
+            continue;
+        }
+        if(retval == 0)
+            throw IOException(string("IO Error : ") + strerror(ENOSPC));
+        size_t written = retval;
+        wait = token && written < requested; // a short write means the fd is full, waiting lets the token cancel a blocking fd
+        while(written > 0)
+        {
+            size_t left = vectors[firstVector].size - firstVectorOffset;
+            if(written < left)
+            {
+                firstVectorOffset += written;
+                break;
+            }
+            written -= left;
+            firstVector++;
+            firstVectorOffset = 0;
+        }
+    }
+}
+
 uint8_t DumpingReader::readByte()
 {
     uint8_t retval = reader.readByte();
     cerr << "Read Byte : " << (unsigned)retval << "\n";
     return retval;
 }
+
+uint64_t FileReader::size()
+{
+    struct stat st;
+    if(0 != fstat(fileno(f), &st))
+        throw IOException(string("IO Error : ") + strerror(errno));
+    return st.st_size;
+}
+
+uint64_t FileReader::tell()
+{
+    off_t retval = ftello(f);
+    if(retval == -1)
+        throw IOException(string("IO Error : ") + strerror(errno));
+    return retval;
+}
+
+void FileReader::seek(uint64_t offset)
+{
+    if(offset > size())
+        throw IOException("IO Error : seek past the end");
+    if(0 != fseeko(f, (off_t)offset, SEEK_SET))
+        throw IOException(string("IO Error : ") + strerror(errno));
+}
+
+MappedFileReader::MappedFileReader(wstring fileName)
+    : mem(nullptr), offset(0), length(0)
+{
+    string str = wstringToString(fileName);
+    int fd = open(str.c_str(), O_RDONLY);
+    if(fd == -1)
+        throw IOException(string("IO Error : ") + strerror(errno));
+    struct stat st;
+    if(0 != fstat(fd, &st))
+    {
+        int errno_value = errno;
+        close(fd);
+        throw IOException(string("IO Error : ") + strerror(errno_value));
+    }
+    length = st.st_size;
+    if(length > 0) // can't map an empty file
+    {
+        void * p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED)
+        {
+            int errno_value = errno;
+            close(fd);
+            throw IOException(string("IO Error : ") + strerror(errno_value));
+        }
+        madvise(p, length, MADV_SEQUENTIAL);
+        mem = (const uint8_t *)p;
+    }
+    close(fd); // the mapping keeps the file referenced
+}
+
+MappedFileReader::~MappedFileReader()
+{
+    if(mem != nullptr)
+        munmap((void *)mem, length);
+}
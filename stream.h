@@ -10,6 +10,7 @@
 #include <memory>
 #include <list>
 #include <sstream>
+#include <chrono>
 #include "util.h"
 #ifdef DEBUG_STREAM
 #include <iostream>
@@ -75,9 +76,83 @@ public:
     }
 };
 
-class Reader
+class TimeoutException final : public IOException
+{
+public:
+    explicit TimeoutException()
+        : IOException("IO Error : operation timed out")
+    {
+    }
+};
+
+class CancelledException final : public IOException
+{
+public:
+    explicit CancelledException()
+        : IOException("IO Error : operation cancelled")
+    {
+    }
+};
+
+typedef chrono::steady_clock StreamClock;
+
+/** cancels blocking stream operations from another thread<br/>
+    streams that have the token set throw CancelledException once cancel is called
+ */
+class CancellationToken final
 {
+    CancellationToken(const CancellationToken &) = delete;
+    const CancellationToken & operator =(const CancellationToken &) = delete;
+public:
+    typedef list<function<void()>>::iterator ListenerHandle;
 private:
+    mutex lock;
+    atomic_bool cancelledInternal;
+    list<function<void()>> listeners;
+    int pipeFds[2];
+public:
+    CancellationToken();
+    ~CancellationToken();
+    void cancel();
+    bool cancelled() const
+    {
+        return cancelledInternal;
+    }
+    void check() const
+    {
+        if(cancelled())
+            throw CancelledException();
+    }
+    /** @return a file descriptor that becomes readable when the token is cancelled
+     */
+    int waitFd() const
+    {
+        return pipeFds[0];
+    }
+    /** add a function that is called when the token is cancelled<br/>
+        it's called immediately if the token is already cancelled
+     */
+    ListenerHandle addListener(function<void()> fn);
+    void removeListener(ListenerHandle handle);
+};
+
+/** wait until fd is readable, the deadline passes or token is cancelled
+    @return true if fd is readable, false if the deadline passed
+    @throws CancelledException if token is cancelled
+ */
+bool waitFdReadable(int fd, StreamClock::time_point deadline, shared_ptr<CancellationToken> token);
+/** wait until fd is writable, the deadline passes or token is cancelled
+    @return true if fd is writable, false if the deadline passed
+    @throws CancelledException if token is cancelled
+ */
+bool waitFdWritable(int fd, StreamClock::time_point deadline, shared_ptr<CancellationToken> token);
+
+class Reader
+{
+public:
+    /** the validation used by the readLimited functions
+        @throws InvalidDataValueException if v isn't in [min, max]
+     */
     template <typename T>
     static T limitAfterRead(T v, T min, T max)
     {
@@ -89,6 +164,20 @@ private:
         }
         return v;
     }
+    /** the validation used by the readFinite functions
+        @throws InvalidDataValueException if v isn't finite
+     */
+    template <typename T>
+    static T finiteAfterRead(T v)
+    {
+        if(!isfinite(v))
+        {
+            throw InvalidDataValueException("read value is not finite");
+        }
+        return v;
+    }
+protected:
+    shared_ptr<CancellationToken> cancellationToken;
 public:
     Reader()
     {
@@ -99,13 +188,62 @@ public:
     {
     }
     virtual uint8_t readByte() = 0;
-    void readBytes(uint8_t * array, size_t count)
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token)
+    {
+        cancellationToken = token;
+    }
+    shared_ptr<CancellationToken> getCancellationToken() const
+    {
+        return cancellationToken;
+    }
+    /** wait until a byte can be read without blocking
+        @return true if readByte won't block, false if the deadline passed
+        the default implementation can't tell so it assumes that readByte won't block
+     */
+    virtual bool waitReadable(StreamClock::time_point deadline)
+    {
+        if(cancellationToken)
+            cancellationToken->check();
+        return true;
+    }
+    bool tryReadByte(uint8_t & v)
+    {
+        if(!waitReadable(StreamClock::now()))
+            return false;
+        v = readByte();
+        return true;
+    }
+    uint8_t readByteBefore(StreamClock::time_point deadline)
+    {
+        if(!waitReadable(deadline))
+            throw TimeoutException();
+        return readByte();
+    }
+    uint8_t readByteWithTimeout(StreamClock::duration timeout)
+    {
+        return readByteBefore(StreamClock::now() + timeout);
+    }
+    virtual void readBytes(uint8_t * array, size_t count)
     {
         for(size_t i = 0; i < count; i++)
         {
             array[i] = readByte();
         }
     }
+    /** get the bytes that are already in memory and can be read without blocking
+        @param available set to the number of bytes available
+        @return a pointer to the available bytes or nullptr if there aren't any
+        call skipBuffered to consume bytes after using them
+     */
+    virtual const uint8_t * peekBuffered(size_t & available)
+    {
+        available = 0;
+        return nullptr;
+    }
+    virtual void skipBuffered(size_t count)
+    {
+        assert(count == 0);
+    }
     uint8_t readU8()
     {
         uint8_t retval = readByte();
@@ -187,6 +325,88 @@ public:
     {
         return readU8() != 0;
     }
+private:
+    /** decode a LEB128 varint of at most maxBytes bytes
+     */
+    uint64_t readVarUInt(size_t maxBytes, uint64_t maxValue)
+    {
+        size_t available;
+        const uint8_t * p = peekBuffered(available);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if(available >= sizeof(uint64_t))
+        {
+            // fast path : find the last byte of the varint in the next 8 bytes and then compact the 7 bit groups
+            uint64_t word;
+            memcpy((void *)&word, (const void *)p, sizeof(word));
+            uint64_t stopBits = ~word & 0x8080808080808080ULL;
+            if(stopBits != 0)
+            {
+                size_t length = (__builtin_ctzll(stopBits) + 1) / 8;
+                if(length > maxBytes)
+                    throw InvalidDataValueException("varint too long");
+                if(length < sizeof(uint64_t))
+                    word &= ((uint64_t)1 << (8 * length)) - 1;
+                uint64_t retval = (word & 0x7FULL)
+                                  | ((word & 0x7F00ULL) >> 1)
+                                  | ((word & 0x7F0000ULL) >> 2)
+                                  | ((word & 0x7F000000ULL) >> 3)
+                                  | ((word & 0x7F00000000ULL) >> 4)
+                                  | ((word & 0x7F0000000000ULL) >> 5)
+                                  | ((word & 0x7F000000000000ULL) >> 6)
+                                  | ((word & 0x7F00000000000000ULL) >> 7);
+                skipBuffered(length);
+                if(retval > maxValue)
+                    throw InvalidDataValueException("varint out of range");
+                return retval;
+            }
+        }
+#else
+        (void)p;
+        (void)available;
+#endif
+        uint64_t retval = 0;
+        for(size_t i = 0; i < maxBytes; i++)
+        {
+            uint64_t v = readByte();
+            if(7 * i + 7 > 64 && ((v & 0x7F) >> (64 - 7 * i)) != 0) // bits past the top of uint64_t
+                throw InvalidDataValueException("varint out of range");
+            retval |= (v & 0x7F) << (7 * i);
+            if((v & 0x80) == 0)
+            {
+                if(retval > maxValue)
+                    throw InvalidDataValueException("varint out of range");
+                return retval;
+            }
+        }
+        throw InvalidDataValueException("varint too long");
+    }
+public:
+    uint32_t readVarU32()
+    {
+        uint32_t retval = (uint32_t)readVarUInt(5, 0xFFFFFFFFU);
+        DUMP_V(readVarU32, retval);
+        return retval;
+    }
+    uint64_t readVarU64()
+    {
+        uint64_t retval = readVarUInt(10, ~(uint64_t)0);
+        DUMP_V(readVarU64, retval);
+        return retval;
+    }
+    int32_t readVarS32() // zig-zag encoded
+    {
+        uint32_t v = readVarU32();
+        int32_t retval = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        DUMP_V(readVarS32, retval);
+        return retval;
+    }
+    int64_t readVarS64() // zig-zag encoded
+    {
+        uint64_t v = readVarU64();
+        int64_t retval = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        DUMP_V(readVarS64, retval);
+        return retval;
+    }
     wstring readString()
     {
         wstring retval = L"";
@@ -281,21 +501,11 @@ public:
     }
     float readFiniteF32()
     {
-        float retval = readF32();
-        if(!isfinite(retval))
-        {
-            throw InvalidDataValueException("read value is not finite");
-        }
-        return retval;
+        return finiteAfterRead(readF32());
     }
     double readFiniteF64()
     {
-        double retval = readF64();
-        if(!isfinite(retval))
-        {
-            throw InvalidDataValueException("read value is not finite");
-        }
-        return retval;
+        return finiteAfterRead(readF64());
     }
     float readLimitedF32(float min, float max)
     {
@@ -307,8 +517,48 @@ public:
     }
 };
 
+/** a reader that can move to any offset, like a file
+ */
+class SeekableReader : public Reader
+{
+public:
+    /** @return the total number of bytes
+     */
+    virtual uint64_t size() = 0;
+    /** @return the offset of the next byte read
+     */
+    virtual uint64_t tell() = 0;
+    /** move to offset, seeking to size() makes the next read throw EOFException
+        @throws IOException if offset is past the end
+     */
+    virtual void seek(uint64_t offset) = 0;
+};
+
+/** a piece of memory to write with Writer::writeVectored
+ */
+struct IOVector final
+{
+    const uint8_t * data;
+    size_t size;
+    IOVector(const uint8_t * data, size_t size)
+        : data(data), size(size)
+    {
+    }
+    IOVector()
+        : data(nullptr), size(0)
+    {
+    }
+};
+
+/** write all of vectors to fd with as few writev calls as possible
+    @throws IOException on error
+ */
+void writeFdVectored(int fd, const IOVector * vectors, size_t count, shared_ptr<CancellationToken> token);
+
 class Writer
 {
+protected:
+    shared_ptr<CancellationToken> cancellationToken;
 public:
     Writer()
     {
@@ -322,11 +572,43 @@ public:
     virtual void flush()
     {
     }
-    void writeBytes(const uint8_t * array, size_t count)
+    virtual void setCancellationToken(shared_ptr<CancellationToken> token)
+    {
+        cancellationToken = token;
+    }
+    shared_ptr<CancellationToken> getCancellationToken() const
+    {
+        return cancellationToken;
+    }
+    /** wait until a byte can be written without blocking
+        @return true if writeByte won't block, false if the deadline passed
+        the default implementation can't tell so it assumes that writeByte won't block
+     */
+    virtual bool waitWritable(StreamClock::time_point deadline)
+    {
+        if(cancellationToken)
+            cancellationToken->check();
+        return true;
+    }
+    bool tryWriteByte(uint8_t v)
+    {
+        if(!waitWritable(StreamClock::now()))
+            return false;
+        writeByte(v);
+        return true;
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count)
     {
         for(size_t i = 0; i < count; i++)
             writeByte(array[i]);
     }
+    /** write several pieces of memory in order, like writev
+     */
+    virtual void writeVectored(const IOVector * vectors, size_t count)
+    {
+        for(size_t i = 0; i < count; i++)
+            writeBytes(vectors[i].data, vectors[i].size);
+    }
     void writeU8(uint8_t v)
     {
         writeByte(v);
@@ -388,6 +670,30 @@ public:
     {
         writeU8(v ? 1 : 0);
     }
+    void writeVarU64(uint64_t v) // LEB128
+    {
+        uint8_t bytes[10];
+        size_t length = 0;
+        while(v >= 0x80)
+        {
+            bytes[length++] = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        bytes[length++] = (uint8_t)v;
+        writeBytes(bytes, length);
+    }
+    void writeVarU32(uint32_t v)
+    {
+        writeVarU64(v);
+    }
+    void writeVarS32(int32_t v) // zig-zag encoded
+    {
+        writeVarU32(((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+    }
+    void writeVarS64(int64_t v) // zig-zag encoded
+    {
+        writeVarU64(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+    }
     void writeString(wstring v)
     {
         for(size_t i = 0; i < v.length(); i++)
@@ -420,7 +726,7 @@ public:
     }
 };
 
-class FileReader final : public Reader
+class FileReader final : public SeekableReader
 {
 private:
     FILE * f;
@@ -452,6 +758,9 @@ public:
         }
         return ch;
     }
+    virtual uint64_t size() override;
+    virtual uint64_t tell() override;
+    virtual void seek(uint64_t offset) override;
 };
 
 class FileWriter final : public Writer
@@ -480,6 +789,11 @@ public:
         if(fputc(v, f) == EOF)
             throw IOException("IO Error : can't write to file");
     }
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        if(fwrite((const void *)array, 1, count, f) != count)
+            throw IOException("IO Error : can't write to file");
+    }
     virtual void flush() override
     {
         if(EOF == fflush(f))
@@ -487,7 +801,7 @@ public:
     }
 };
 
-class MemoryReader final : public Reader
+class MemoryReader final : public SeekableReader
 {
 private:
     const shared_ptr<const uint8_t> mem;
@@ -509,6 +823,131 @@ public:
             throw EOFException();
         return mem.get()[offset++];
     }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        size_t available = length - offset;
+        if(count > available)
+        {
+            memcpy((void *)array, (const void *)&mem.get()[offset], available);
+            offset = length;
+            throw EOFException();
+        }
+        memcpy((void *)array, (const void *)&mem.get()[offset], count);
+        offset += count;
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = length - offset;
+        if(available == 0)
+            return nullptr;
+        return &mem.get()[offset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= length - offset);
+        offset += count;
+    }
+    virtual uint64_t size() override
+    {
+        return length;
+    }
+    virtual uint64_t tell() override
+    {
+        return offset;
+    }
+    virtual void seek(uint64_t offset) override
+    {
+        if(offset > length)
+            throw IOException("IO Error : seek past the end");
+        this->offset = offset;
+    }
+};
+
+/** appends the bytes written to it to a vector, its own or one it's given
+ */
+class VectorWriter final : public Writer
+{
+private:
+    vector<uint8_t> ownData;
+    vector<uint8_t> & data;
+public:
+    VectorWriter()
+        : data(ownData)
+    {
+    }
+    explicit VectorWriter(vector<uint8_t> & data)
+        : data(data)
+    {
+    }
+    vector<uint8_t> & getData()
+    {
+        return data;
+    }
+    virtual void writeByte(uint8_t v) override
+    {
+        data.push_back(v);
+    }
+    virtual void writeBytes(const uint8_t * array, size_t count) override
+    {
+        data.insert(data.end(), array, array + count);
+    }
+};
+
+/** read a file by mapping it into memory
+ */
+class MappedFileReader final : public SeekableReader
+{
+private:
+    const uint8_t * mem;
+    size_t offset;
+    size_t length;
+public:
+    explicit MappedFileReader(wstring fileName);
+    virtual ~MappedFileReader();
+    virtual uint8_t readByte() override
+    {
+        if(offset >= length)
+            throw EOFException();
+        return mem[offset++];
+    }
+    virtual void readBytes(uint8_t * array, size_t count) override
+    {
+        size_t available = length - offset;
+        if(count > available)
+        {
+            memcpy((void *)array, (const void *)&mem[offset], available);
+            offset = length;
+            throw EOFException();
+        }
+        memcpy((void *)array, (const void *)&mem[offset], count);
+        offset += count;
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        available = length - offset;
+        if(available == 0)
+            return nullptr;
+        return &mem[offset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        assert(count <= length - offset);
+        offset += count;
+    }
+    virtual uint64_t size() override
+    {
+        return length;
+    }
+    virtual uint64_t tell() override
+    {
+        return offset;
+    }
+    virtual void seek(uint64_t offset) override
+    {
+        if(offset > length)
+            throw IOException("IO Error : seek past the end");
+        this->offset = offset;
+    }
 };
 
 class StreamPipe final
@@ -634,6 +1073,25 @@ struct StreamServer
     {
     }
     virtual shared_ptr<StreamRW> accept() = 0;
+    /** @return a file descriptor that is readable when a stream can be accepted or -1 if the server can't be polled
+     */
+    virtual int pollFd()
+    {
+        return -1;
+    }
+    /** accept a stream without blocking, only used for servers that have a pollFd
+        @return nullptr if no stream is ready
+     */
+    virtual shared_ptr<StreamRW> tryAccept()
+    {
+        return accept();
+    }
+    /** make accept throw NoStreamsLeftException, including an accept blocked on another thread<br/>
+        the default does nothing, so a blocked accept only returns once a stream arrives
+     */
+    virtual void close()
+    {
+    }
 };
 
 class StreamServerWrapper final : public StreamServer
@@ -658,6 +1116,11 @@ public:
         streams.pop_front();
         return retval;
     }
+    virtual void close() override
+    {
+        if(nextServer != nullptr)
+            nextServer->close();
+    }
 };
 
 #endif // STREAM_H
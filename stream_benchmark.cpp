@@ -0,0 +1,562 @@
+#include "stream.h"
+#include "compressed_stream.h"
+#include "parallel_compressed_stream.h"
+#include "seekable_compressed_stream.h"
+#include "framed_stream.h"
+#include "crc32c.h"
+#include "buffer_pool.h"
+#include "capture_stream.h"
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <random>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+// micro-benchmarks for the stream implementations
+// outputs one JSON object per line :
+// {"name":"...","message_size":N,"iterations":N,"ns_per_op":X,"bytes_per_s":X,"pool_slab_allocations":N}
+// pool_slab_allocations is the number of heap allocations the buffer pool did in the last run
+// usage : stream-benchmark [--min-time=<seconds>] [<name filter>]
+
+namespace
+{
+double minTime = 0.2;
+
+class NullWriter final : public Writer
+{
+public:
+    size_t count = 0;
+    virtual void writeByte(uint8_t) override
+    {
+        count++;
+    }
+    virtual void writeBytes(const uint8_t *, size_t count) override
+    {
+        this->count += count;
+    }
+};
+
+class RepeatingReader final : public Reader // reads the same bytes over and over
+{
+private:
+    const vector<uint8_t> & data;
+    size_t offset = 0;
+public:
+    RepeatingReader(const vector<uint8_t> & data)
+        : data(data)
+    {
+        assert(!data.empty());
+    }
+    virtual uint8_t readByte() override
+    {
+        if(offset >= data.size())
+            offset = 0;
+        return data[offset++];
+    }
+    virtual const uint8_t * peekBuffered(size_t & available) override
+    {
+        if(offset >= data.size())
+            offset = 0;
+        available = data.size() - offset;
+        return &data[offset];
+    }
+    virtual void skipBuffered(size_t count) override
+    {
+        offset += count;
+    }
+};
+
+vector<uint8_t> makeTelemetry(size_t size) // deterministic data that looks like the control frames
+{
+    minstd_rand rg(12345);
+    string str;
+    while(str.size() < size)
+    {
+        for(int i = 1; i <= 5; i++)
+        {
+            str += to_string(i) + "  " + to_string((unsigned)(rg() % 0x100)) + "  ";
+        }
+        str += "0  0  0  ";
+    }
+    return vector<uint8_t>(str.begin(), str.begin() + size);
+}
+
+vector<uint8_t> compress(const vector<uint8_t> & data, LZ77Format format = LZ77Format::Legacy)
+{
+    VectorWriter writer;
+    {
+        CompressWriter compressWriter(writer, CompressWriter::defaultLevel, format);
+        compressWriter.writeBytes(data.data(), data.size());
+        compressWriter.flush();
+    }
+    return writer.getData();
+}
+
+shared_ptr<const uint8_t> toSharedMemory(const vector<uint8_t> & data)
+{
+    uint8_t * mem = new uint8_t[data.size()];
+    memcpy((void *)mem, (const void *)data.data(), data.size());
+    return shared_ptr<const uint8_t>(mem, [](const uint8_t * p)
+    {
+        delete []p;
+    });
+}
+
+double secondsSince(StreamClock::time_point startTime)
+{
+    return chrono::duration_cast<chrono::duration<double>>(StreamClock::now() - startTime).count();
+}
+
+struct Benchmark final
+{
+    string name;
+    size_t messageSize;
+    function<double(size_t iterations)> fn; // returns the time taken in seconds
+};
+
+void runBenchmark(const Benchmark & benchmark)
+{
+    size_t iterations = 1;
+    double seconds;
+    uint64_t slabAllocations;
+    while(true)
+    {
+        slabAllocations = BufferPool::getStats().slabAllocations;
+        seconds = benchmark.fn(iterations);
+        slabAllocations = BufferPool::getStats().slabAllocations - slabAllocations;
+        if(seconds >= minTime || iterations >= ((size_t)1 << 40))
+            break;
+        double scale = (seconds <= 0) ? 100 : limit<double>(minTime * 1.2 / seconds, 2, 100);
+        iterations = (size_t)ceil(iterations * scale);
+    }
+    double nsPerOp = seconds * 1e9 / iterations;
+    double bytesPerSecond = (double)benchmark.messageSize * iterations / seconds;
+    printf("{\"name\":\"%s\",\"message_size\":%zu,\"iterations\":%zu,\"ns_per_op\":%.2f,\"bytes_per_s\":%.0f,\"pool_slab_allocations\":%llu}\n",
+           benchmark.name.c_str(), benchmark.messageSize, iterations, nsPerOp, bytesPerSecond, (unsigned long long)slabAllocations);
+    fflush(stdout);
+}
+
+vector<Benchmark> makeBenchmarks()
+{
+    vector<Benchmark> retval;
+    const size_t messageSizes[] = {16, 256, 4096, 65536};
+    for(size_t messageSize : messageSizes)
+    {
+        retval.push_back(Benchmark{"MemoryReader.readByte", messageSize, [messageSize](size_t iterations)
+        {
+            shared_ptr<const uint8_t> mem = toSharedMemory(makeTelemetry(messageSize));
+            StreamClock::time_point startTime = StreamClock::now();
+            unsigned sum = 0;
+            for(size_t i = 0; i < iterations; i++)
+            {
+                MemoryReader reader(mem, messageSize);
+                for(size_t j = 0; j < messageSize; j++)
+                    sum += reader.readByte();
+            }
+            double retval = secondsSince(startTime);
+            if(sum == 1) // so the loop isn't optimized away
+                cerr << "";
+            return retval;
+        }});
+        retval.push_back(Benchmark{"MemoryReader.readBytes", messageSize, [messageSize](size_t iterations)
+        {
+            shared_ptr<const uint8_t> mem = toSharedMemory(makeTelemetry(messageSize));
+            vector<uint8_t> buffer(messageSize);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                MemoryReader reader(mem, messageSize);
+                reader.readBytes(buffer.data(), messageSize);
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"FileWriter.writeByte", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            FILE * f = tmpfile();
+            if(f == nullptr)
+                throw IOException(string("IO Error : ") + strerror(errno));
+            FileWriter writer(f);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                for(uint8_t v : data)
+                    writer.writeByte(v);
+                writer.flush();
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"FileReader.readByte", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            FILE * f = tmpfile();
+            if(f == nullptr)
+                throw IOException(string("IO Error : ") + strerror(errno));
+            for(size_t i = 0; i < iterations; i++)
+                fwrite((const void *)data.data(), 1, data.size(), f);
+            fflush(f);
+            rewind(f);
+            FileReader reader(f);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                for(size_t j = 0; j < messageSize; j++)
+                    reader.readByte();
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"StreamPipe.transfer", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            StreamPipe pipe;
+            shared_ptr<Reader> preader = pipe.preader();
+            StreamClock::time_point startTime = StreamClock::now();
+            thread readerThread([preader, iterations, messageSize]()
+            {
+                vector<uint8_t> buffer(messageSize);
+                for(size_t i = 0; i < iterations; i++)
+                    preader->readBytes(buffer.data(), messageSize);
+            });
+            for(size_t i = 0; i < iterations; i++)
+            {
+                pipe.writer().writeBytes(data.data(), data.size());
+                pipe.writer().flush();
+            }
+            readerThread.join();
+            return secondsSince(startTime);
+        }});
+        if(messageSize <= 4096) // round trips of bigger messages take too long
+        {
+            retval.push_back(Benchmark{"StreamBidirectionalPipe.roundTrip", messageSize, [messageSize](size_t iterations)
+            {
+                vector<uint8_t> data = makeTelemetry(messageSize);
+                StreamBidirectionalPipe pipe;
+                shared_ptr<StreamRW> port2 = pipe.pport2();
+                StreamClock::time_point startTime = StreamClock::now();
+                thread echoThread([port2, iterations, messageSize]()
+                {
+                    vector<uint8_t> buffer(messageSize);
+                    for(size_t i = 0; i < iterations; i++)
+                    {
+                        port2->reader().readBytes(buffer.data(), messageSize);
+                        port2->writer().writeBytes(buffer.data(), messageSize);
+                        port2->writer().flush();
+                    }
+                });
+                vector<uint8_t> buffer(messageSize);
+                for(size_t i = 0; i < iterations; i++)
+                {
+                    pipe.port1().writer().writeBytes(data.data(), data.size());
+                    pipe.port1().writer().flush();
+                    pipe.port1().reader().readBytes(buffer.data(), messageSize);
+                }
+                echoThread.join();
+                return secondsSince(startTime);
+            }});
+        }
+        for(int level : {CompressWriter::defaultLevel, CompressWriter::minLevel, CompressWriter::maxLevel})
+        {
+            string name = "CompressWriter.write";
+            if(level != CompressWriter::defaultLevel)
+                name += ".level" + to_string(level);
+            retval.push_back(Benchmark{name, messageSize, [messageSize, level](size_t iterations)
+            {
+                vector<uint8_t> data = makeTelemetry(messageSize * 16);
+                NullWriter nullWriter;
+                CompressWriter writer(nullWriter, level);
+                StreamClock::time_point startTime = StreamClock::now();
+                for(size_t i = 0; i < iterations; i++)
+                {
+                    writer.writeBytes(&data[(i % 16) * messageSize], messageSize);
+                    writer.flush();
+                }
+                return secondsSince(startTime);
+            }});
+        }
+        retval.push_back(Benchmark{"CompressWriter.write.entropy", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize * 16);
+            NullWriter nullWriter;
+            CompressWriter writer(nullWriter, CompressWriter::defaultLevel, LZ77Format::Entropy);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                writer.writeBytes(&data[(i % 16) * messageSize], messageSize);
+                writer.flush();
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"WideCompressWriter.write.entropy", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize * 16);
+            NullWriter nullWriter;
+            WideCompressWriter writer(nullWriter, WideCompressWriter::defaultLevel, LZ77Format::Entropy);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                writer.writeBytes(&data[(i % 16) * messageSize], messageSize);
+                writer.flush();
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"ExpandReader.read", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> compressed = compress(makeTelemetry(max<size_t>(messageSize, 65536)));
+            RepeatingReader compressedReader(compressed);
+            ExpandReader reader(compressedReader);
+            vector<uint8_t> buffer(messageSize);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+                reader.readBytes(buffer.data(), messageSize);
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"ExpandReader.read.entropy", messageSize, [messageSize](size_t iterations)
+        {
+            const size_t size = 1 << 20; // a multiple of every message size so the stream starts again at a message boundary
+            shared_ptr<const uint8_t> compressed;
+            size_t compressedSize;
+            {
+                vector<uint8_t> data = compress(makeTelemetry(size), LZ77Format::Entropy);
+                compressed = toSharedMemory(data);
+                compressedSize = data.size();
+            }
+            vector<uint8_t> buffer(messageSize);
+            shared_ptr<ExpandReader> reader;
+            size_t readCount = size;
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                if(readCount >= size)
+                {
+                    reader = make_shared<ExpandReader>(make_shared<MemoryReader>(compressed, compressedSize));
+                    readCount = 0;
+                }
+                reader->readBytes(buffer.data(), messageSize);
+                readCount += messageSize;
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"ParallelCompressWriter.write", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize * 16);
+            StreamClock::time_point startTime = StreamClock::now();
+            {
+                ParallelCompressWriter writer(make_shared<NullWriter>());
+                for(size_t i = 0; i < iterations; i++)
+                    writer.writeBytes(&data[(i % 16) * messageSize], messageSize);
+                writer.flush();
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"ParallelExpandReader.read", messageSize, [messageSize](size_t iterations)
+        {
+            const size_t size = 1 << 22; // a multiple of every message size so the stream starts again at a message boundary
+            shared_ptr<const uint8_t> compressed;
+            size_t compressedSize;
+            {
+                auto writer = make_shared<VectorWriter>();
+                {
+                    ParallelCompressWriter compressWriter(writer);
+                    vector<uint8_t> data = makeTelemetry(size);
+                    compressWriter.writeBytes(data.data(), data.size());
+                }
+                compressed = toSharedMemory(writer->getData());
+                compressedSize = writer->getData().size();
+            }
+            vector<uint8_t> buffer(messageSize);
+            shared_ptr<ParallelExpandReader> reader;
+            size_t readCount = size;
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                if(readCount >= size)
+                {
+                    reader = make_shared<ParallelExpandReader>(make_shared<MemoryReader>(compressed, compressedSize));
+                    readCount = 0;
+                }
+                reader->readBytes(buffer.data(), messageSize);
+                readCount += messageSize;
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"SeekableExpandReader.seek", messageSize, [messageSize](size_t iterations)
+        {
+            const size_t size = 1 << 22;
+            shared_ptr<const uint8_t> compressed;
+            size_t compressedSize;
+            {
+                auto writer = make_shared<VectorWriter>();
+                {
+                    SeekableCompressWriter compressWriter(writer);
+                    vector<uint8_t> data = makeTelemetry(size);
+                    compressWriter.writeBytes(data.data(), data.size());
+                }
+                compressed = toSharedMemory(writer->getData());
+                compressedSize = writer->getData().size();
+            }
+            SeekableExpandReader reader(make_shared<MemoryReader>(compressed, compressedSize));
+            vector<uint8_t> buffer(messageSize);
+            minstd_rand rg(12345);
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                reader.seek(rg() % (size - messageSize + 1));
+                reader.readBytes(buffer.data(), messageSize);
+            }
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"ReplayReader.read", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            auto captureWriter = make_shared<VectorWriter>();
+            {
+                CaptureRecorder recorder(captureWriter, false, (size_t)-1, StreamClock::duration::zero());
+                for(size_t i = 0; i < iterations; i++)
+                    recorder.record(CaptureKind::Read, data.data(), data.size());
+            }
+            shared_ptr<const uint8_t> capture = toSharedMemory(captureWriter->getData());
+            StreamClock::time_point startTime = StreamClock::now();
+            ReplayReader reader(make_shared<MemoryReader>(capture, captureWriter->getData().size()), CaptureKind::Read, ReplaySpeed::AsFastAsPossible);
+            for(size_t i = 0; i < iterations; i++)
+                reader.readBytes(data.data(), messageSize);
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"crc32c", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            uint32_t crc = 0;
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+                crc = crc32c(data.data(), messageSize, crc);
+            double retval = secondsSince(startTime);
+            if(crc == 1) // so the loop isn't optimized away
+                cerr << "";
+            return retval;
+        }});
+        retval.push_back(Benchmark{"FrameWriter.FrameReader", messageSize, [messageSize](size_t iterations)
+        {
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            StreamPipe pipe;
+            shared_ptr<Reader> preader = pipe.preader();
+            StreamClock::time_point startTime = StreamClock::now();
+            thread readerThread([preader, iterations, messageSize]()
+            {
+                FrameReader reader(preader);
+                vector<uint8_t> buffer(messageSize);
+                for(size_t i = 0; i < iterations; i++)
+                    reader.readBytes(buffer.data(), messageSize);
+            });
+            {
+                FrameWriter writer(pipe.pwriter());
+                for(size_t i = 0; i < iterations; i++)
+                {
+                    writer.writeBytes(data.data(), data.size());
+                    writer.flush();
+                }
+            }
+            readerThread.join();
+            return secondsSince(startTime);
+        }});
+        retval.push_back(Benchmark{"Reader.readString", messageSize, [messageSize](size_t iterations)
+        {
+            VectorWriter writer;
+            vector<uint8_t> data = makeTelemetry(messageSize);
+            wstring str(data.begin(), data.end());
+            writer.writeString(str);
+            shared_ptr<const uint8_t> mem = toSharedMemory(writer.getData());
+            size_t length = writer.getData().size();
+            StreamClock::time_point startTime = StreamClock::now();
+            for(size_t i = 0; i < iterations; i++)
+            {
+                MemoryReader reader(mem, length);
+                reader.readString();
+            }
+            return secondsSince(startTime);
+        }});
+    }
+    retval.push_back(Benchmark{"BufferPool.allocate", IOBuffer::capacity, [](size_t iterations)
+    {
+        StreamClock::time_point startTime = StreamClock::now();
+        for(size_t i = 0; i < iterations; i++)
+        {
+            IOBuffer buffer = IOBuffer::allocate();
+            buffer.data()[0] = (uint8_t)i;
+        }
+        return secondsSince(startTime);
+    }});
+    retval.push_back(Benchmark{"Reader.readU32", sizeof(uint32_t), [](size_t iterations)
+    {
+        const size_t count = 4096;
+        vector<uint8_t> data = makeTelemetry(count * sizeof(uint32_t));
+        shared_ptr<const uint8_t> mem = toSharedMemory(data);
+        uint32_t sum = 0;
+        StreamClock::time_point startTime = StreamClock::now();
+        for(size_t i = 0; i < iterations;)
+        {
+            MemoryReader reader(mem, data.size());
+            for(size_t j = 0; j < count && i < iterations; j++, i++)
+                sum += reader.readU32();
+        }
+        double retval = secondsSince(startTime);
+        if(sum == 1) // so the loop isn't optimized away
+            cerr << "";
+        return retval;
+    }});
+    retval.push_back(Benchmark{"Reader.readVarU32", sizeof(uint32_t), [](size_t iterations)
+    {
+        const size_t count = 4096;
+        VectorWriter writer;
+        minstd_rand rg(12345);
+        for(size_t i = 0; i < count; i++)
+            writer.writeVarU32((uint32_t)(rg() >> (rg() % 31)));
+        shared_ptr<const uint8_t> mem = toSharedMemory(writer.getData());
+        size_t length = writer.getData().size();
+        uint32_t sum = 0;
+        StreamClock::time_point startTime = StreamClock::now();
+        for(size_t i = 0; i < iterations;)
+        {
+            MemoryReader reader(mem, length);
+            for(size_t j = 0; j < count && i < iterations; j++, i++)
+                sum += reader.readVarU32();
+        }
+        double retval = secondsSince(startTime);
+        if(sum == 1) // so the loop isn't optimized away
+            cerr << "";
+        return retval;
+    }});
+    retval.push_back(Benchmark{"Writer.writeU32", sizeof(uint32_t), [](size_t iterations)
+    {
+        NullWriter nullWriter;
+        Writer * volatile pwriter = &nullWriter; // so the calls aren't optimized away
+        StreamClock::time_point startTime = StreamClock::now();
+        for(size_t i = 0; i < iterations; i++)
+            pwriter->writeU32((uint32_t)i);
+        return secondsSince(startTime);
+    }});
+    return retval;
+}
+}
+
+int main(int argc, char ** argv)
+{
+    string filter = "";
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg.substr(0, 11) == "--min-time=")
+            minTime = atof(arg.substr(11).c_str());
+        else
+            filter = arg;
+    }
+    for(const Benchmark & benchmark : makeBenchmarks())
+    {
+        if(benchmark.name.find(filter) == string::npos)
+            continue;
+        runBenchmark(benchmark);
+    }
+    return 0;
+}
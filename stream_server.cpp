@@ -0,0 +1,239 @@
+#include "stream_server.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+InProcessStreamServer::InProcessStreamServer()
+{
+    if(0 != ::pipe(pipeFds))
+        throw IOException(string("IO Error : ") + strerror(errno));
+    fcntl(pipeFds[0], F_SETFL, fcntl(pipeFds[0], F_GETFL) | O_NONBLOCK);
+}
+
+InProcessStreamServer::~InProcessStreamServer()
+{
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+}
+
+namespace
+{
+void signalPipe(int fd)
+{
+    uint8_t v = 0;
+    while(-1 == write(fd, (const void *)&v, 1) && errno == EINTR)
+    {
+    }
+}
+}
+
+shared_ptr<StreamRW> InProcessStreamServer::connect()
+{
+    shared_ptr<StreamBidirectionalPipe> pipe = make_shared<StreamBidirectionalPipe>();
+    // the ports keep the pipe alive
+    shared_ptr<StreamRW> clientPort(pipe, &pipe->port1()), serverPort(pipe, &pipe->port2());
+    add(serverPort);
+    return clientPort;
+}
+
+void InProcessStreamServer::add(shared_ptr<StreamRW> stream)
+{
+    lock_guard<mutex> lockIt(lock);
+    if(closed)
+        throw IOException("IO Error : server closed");
+    streams.push_back(stream);
+    signalPipe(pipeFds[1]);
+}
+
+void InProcessStreamServer::close()
+{
+    lock_guard<mutex> lockIt(lock);
+    if(closed)
+        return;
+    closed = true;
+    signalPipe(pipeFds[1]); // left in the pipe so pollFd stays readable
+}
+
+shared_ptr<StreamRW> InProcessStreamServer::accept()
+{
+    while(true)
+    {
+        shared_ptr<StreamRW> retval = tryAccept();
+        if(retval != nullptr)
+            return retval;
+        waitFdReadable(pipeFds[0], StreamClock::time_point::max(), nullptr);
+    }
+}
+
+shared_ptr<StreamRW> InProcessStreamServer::tryAccept()
+{
+    lock_guard<mutex> lockIt(lock);
+    if(streams.empty())
+    {
+        if(closed)
+            throw NoStreamsLeftException();
+        return nullptr;
+    }
+    shared_ptr<StreamRW> retval = streams.front();
+    streams.pop_front();
+    uint8_t v;
+    while(-1 == read(pipeFds[0], (void *)&v, 1) && errno == EINTR)
+    {
+    }
+    return retval;
+}
+
+MultiplexStreamServer::MultiplexStreamServer(vector<shared_ptr<StreamServer>> servers, shared_ptr<CancellationToken> cancellationToken)
+    : cancellationToken(cancellationToken)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd == -1)
+        throw IOException(string("IO Error : ") + strerror(errno));
+    for(shared_ptr<StreamServer> server : servers)
+    {
+        if(server->pollFd() == -1)
+            threadedServers.push_back(server);
+        else
+            this->servers.push_back(server);
+    }
+    if(!threadedServers.empty())
+    {
+        threadedStreams = make_shared<InProcessStreamServer>();
+        this->servers.push_back(threadedStreams);
+    }
+    for(shared_ptr<StreamServer> server : this->servers)
+    {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = (void *)server.get();
+        if(-1 == epoll_ctl(epollFd, EPOLL_CTL_ADD, server->pollFd(), &event))
+        {
+            int error = errno;
+            ::close(epollFd);
+            throw IOException(string("IO Error : ") + strerror(error));
+        }
+    }
+    if(cancellationToken)
+    {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, cancellationToken->waitFd(), &event);
+    }
+    if(threadedServers.empty())
+        return;
+    shared_ptr<atomic_size_t> runningThreads = make_shared<atomic_size_t>(threadedServers.size());
+    try
+    {
+        for(shared_ptr<StreamServer> server : threadedServers)
+        {
+            shared_ptr<InProcessStreamServer> threadedStreams = this->threadedStreams;
+            acceptThreads.push_back(thread([server, threadedStreams, runningThreads]()
+            {
+                try
+                {
+                    while(true)
+                        threadedStreams->add(server->accept());
+                }
+                catch(IOException &)
+                {
+                }
+                if(--*runningThreads == 0)
+                    threadedStreams->close();
+            }));
+        }
+    }
+    catch(...)
+    {
+        stopAcceptThreads();
+        ::close(epollFd);
+        throw;
+    }
+}
+
+MultiplexStreamServer::~MultiplexStreamServer()
+{
+    stopAcceptThreads();
+    ::close(epollFd);
+}
+
+void MultiplexStreamServer::stopAcceptThreads()
+{
+    if(threadedStreams != nullptr)
+        threadedStreams->close(); // a thread that accepts another stream fails to add it and stops
+    for(shared_ptr<StreamServer> server : threadedServers)
+        server->close();
+    for(thread & acceptThread : acceptThreads)
+        acceptThread.join();
+    acceptThreads.clear();
+}
+
+void MultiplexStreamServer::removeServer(StreamServer * server)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, server->pollFd(), nullptr);
+    readyServers.erase(remove(readyServers.begin(), readyServers.end(), server), readyServers.end());
+    for(auto i = servers.begin(); i != servers.end(); i++)
+    {
+        if(i->get() == server)
+        {
+            servers.erase(i);
+            break;
+        }
+    }
+}
+
+shared_ptr<StreamRW> MultiplexStreamServer::tryAccept()
+{
+    while(true)
+    {
+        if(servers.empty())
+            throw NoStreamsLeftException();
+        if(cancellationToken)
+            cancellationToken->check();
+        if(readyServers.empty())
+        {
+            epoll_event events[16];
+            int count = epoll_wait(epollFd, events, sizeof(events) / sizeof(events[0]), 0);
+            if(count == -1 && errno != EINTR)
+                throw IOException(string("IO Error : ") + strerror(errno));
+            if(count <= 0)
+                return nullptr;
+            for(int i = 0; i < count; i++)
+            {
+                if(events[i].data.ptr != nullptr)
+                    readyServers.push_back((StreamServer *)events[i].data.ptr);
+            }
+            if(readyServers.empty())
+                continue; // just the cancellation token
+        }
+        StreamServer * server = readyServers.front(); // servers that were ready together are taken in turn
+        readyServers.pop_front();
+        try
+        {
+            shared_ptr<StreamRW> retval = server->tryAccept();
+            if(retval != nullptr)
+                return retval;
+        }
+        catch(NoStreamsLeftException &)
+        {
+            removeServer(server);
+        }
+    }
+}
+
+shared_ptr<StreamRW> MultiplexStreamServer::accept()
+{
+    while(true)
+    {
+        shared_ptr<StreamRW> retval = tryAccept();
+        if(retval != nullptr)
+            return retval;
+        waitFdReadable(epollFd, StreamClock::time_point::max(), cancellationToken);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef STREAM_SERVER_H_INCLUDED
+#define STREAM_SERVER_H_INCLUDED
+
+#include "stream.h"
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <thread>
+
+/** a server for streams inside this process<br/>
+    connect makes a StreamBidirectionalPipe and queues one end for accept
+ */
+class InProcessStreamServer final : public StreamServer
+{
+private:
+    mutex lock;
+    deque<shared_ptr<StreamRW>> streams;
+    bool closed = false;
+    int pipeFds[2]; // has a byte for each queued stream so the server can be polled
+public:
+    InProcessStreamServer();
+    ~InProcessStreamServer();
+    /** @return the client end of a new stream
+     */
+    shared_ptr<StreamRW> connect();
+    /** queue a stream for accept
+     */
+    void add(shared_ptr<StreamRW> stream);
+    /** accept throws NoStreamsLeftException once the queued streams are accepted
+     */
+    virtual void close() override;
+    virtual shared_ptr<StreamRW> accept() override;
+    virtual int pollFd() override
+    {
+        return pipeFds[0];
+    }
+    virtual shared_ptr<StreamRW> tryAccept() override;
+};
+
+/** a server that accepts from several servers at once<br/>
+    servers that have a pollFd are all waited on together and when more than one is ready they are taken in turn,
+    the other servers are accepted from on their own threads, which are stopped by closing those servers when this is destroyed
+ */
+class MultiplexStreamServer final : public StreamServer
+{
+private:
+    vector<shared_ptr<StreamServer>> servers; // the servers with a pollFd
+    deque<StreamServer *> readyServers;
+    int epollFd;
+    shared_ptr<CancellationToken> cancellationToken;
+    vector<shared_ptr<StreamServer>> threadedServers; // the servers without a pollFd
+    shared_ptr<InProcessStreamServer> threadedStreams; // gets the streams accepted by acceptThreads
+    vector<thread> acceptThreads;
+    void removeServer(StreamServer * server);
+    void stopAcceptThreads();
+public:
+    /** @param cancellationToken makes accept throw CancelledException when cancelled
+     */
+    explicit MultiplexStreamServer(vector<shared_ptr<StreamServer>> servers, shared_ptr<CancellationToken> cancellationToken = nullptr);
+    ~MultiplexStreamServer();
+    virtual shared_ptr<StreamRW> accept() override;
+    virtual int pollFd() override
+    {
+        return epollFd;
+    }
+    virtual shared_ptr<StreamRW> tryAccept() override;
+};
+
+#endif // STREAM_SERVER_H_INCLUDED
@@ -0,0 +1,82 @@
+#include "stream_timer.h"
+
+using namespace std;
+
+StreamTimer::StreamTimer()
+{
+    timerThread = thread(&StreamTimer::run, this);
+}
+
+StreamTimer::~StreamTimer()
+{
+    {
+        lock_guard<mutex> lockIt(lock);
+        done = true;
+        cond.notify_all();
+    }
+    timerThread.join();
+}
+
+StreamTimer & StreamTimer::get()
+{
+    static StreamTimer retval;
+    return retval;
+}
+
+void StreamTimer::run()
+{
+    unique_lock<mutex> lockIt(lock);
+    while(!done)
+    {
+        if(timers.empty())
+        {
+            cond.wait(lockIt);
+            continue;
+        }
+        auto iter = timers.begin();
+        if(iter->first.first > StreamClock::now())
+        {
+            cond.wait_until(lockIt, iter->first.first);
+            continue;
+        }
+        function<void()> fn = iter->second;
+        runningId = iter->first.second;
+        deadlines.erase(runningId);
+        timers.erase(iter);
+        lockIt.unlock();
+        fn();
+        lockIt.lock();
+        runningId = 0;
+        cond.notify_all();
+    }
+}
+
+StreamTimer::TimerId StreamTimer::schedule(StreamClock::time_point deadline, function<void()> fn)
+{
+    lock_guard<mutex> lockIt(lock);
+    TimerId id = nextId++;
+    bool isFirst = timers.empty() || deadline < timers.begin()->first.first;
+    timers[make_pair(deadline, id)] = fn;
+    deadlines[id] = deadline;
+    if(isFirst)
+        cond.notify_all();
+    return id;
+}
+
+bool StreamTimer::cancel(TimerId id)
+{
+    unique_lock<mutex> lockIt(lock);
+    auto iter = deadlines.find(id);
+    if(iter != deadlines.end())
+    {
+        timers.erase(make_pair(iter->second, id));
+        deadlines.erase(iter);
+        return true;
+    }
+    if(this_thread::get_id() != timerThread.get_id())
+    {
+        while(runningId == id)
+            cond.wait(lockIt);
+    }
+    return false;
+}
@@ -0,0 +1,43 @@
+#ifndef STREAM_TIMER_H_INCLUDED
+#define STREAM_TIMER_H_INCLUDED
+
+#include "stream.h"
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/** a single thread that runs callbacks at deadlines for the streams that need timeouts
+ */
+class StreamTimer final
+{
+    StreamTimer(const StreamTimer &) = delete;
+    const StreamTimer & operator =(const StreamTimer &) = delete;
+public:
+    typedef uint64_t TimerId;
+private:
+    mutex lock;
+    condition_variable cond;
+    bool done = false;
+    TimerId nextId = 1;
+    TimerId runningId = 0;
+    map<pair<StreamClock::time_point, TimerId>, function<void()>> timers;
+    map<TimerId, StreamClock::time_point> deadlines;
+    thread timerThread;
+    void run();
+    StreamTimer();
+public:
+    ~StreamTimer();
+    static StreamTimer & get();
+    /** run fn on the timer thread at deadline<br/>
+        fn must not block for long because it holds up the other timers
+     */
+    TimerId schedule(StreamClock::time_point deadline, function<void()> fn);
+    /** cancel a timer, if the timer is running it waits for it to finish unless called from the timer thread
+        @return true if the timer was cancelled before it ran
+     */
+    bool cancel(TimerId id);
+};
+
+#endif // STREAM_TIMER_H_INCLUDED
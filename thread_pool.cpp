@@ -0,0 +1,106 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace
+{
+thread_local const ThreadPool * currentPool = nullptr; // the pool that the current thread is a worker of
+thread_local size_t currentQueue = 0;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+    : nextQueue(0)
+{
+    if(threadCount == 0)
+        threadCount = thread::hardware_concurrency();
+    if(threadCount == 0)
+        threadCount = 1;
+    for(size_t i = 0; i < threadCount; i++)
+        queues.push_back(make_shared<WorkerQueue>());
+    for(size_t i = 0; i < threadCount; i++)
+        threads.push_back(thread(&ThreadPool::run, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lockIt(lock);
+        done = true;
+        cond.notify_all();
+    }
+    for(thread & t : threads)
+        t.join();
+}
+
+ThreadPool & ThreadPool::get()
+{
+    static ThreadPool retval;
+    return retval;
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    size_t queueIndex;
+    if(currentPool == this)
+        queueIndex = currentQueue;
+    else
+        queueIndex = nextQueue++ % queues.size();
+    lock_guard<mutex> lockIt(lock); // counted under the same lock so a worker that takes the task first can't decrement queuedTasks before it's counted
+    {
+        lock_guard<mutex> lockQueue(queues[queueIndex]->lock);
+        queues[queueIndex]->tasks.push_back(move(task));
+    }
+    queuedTasks++;
+    cond.notify_one();
+}
+
+bool ThreadPool::takeTask(size_t queueIndex, function<void()> & task)
+{
+    {
+        WorkerQueue & queue = *queues[queueIndex];
+        lock_guard<mutex> lockIt(queue.lock);
+        if(!queue.tasks.empty())
+        {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    for(size_t i = 1; i < queues.size(); i++)
+    {
+        WorkerQueue & queue = *queues[(queueIndex + i) % queues.size()];
+        lock_guard<mutex> lockIt(queue.lock);
+        if(!queue.tasks.empty())
+        {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t queueIndex)
+{
+    currentPool = this;
+    currentQueue = queueIndex;
+    function<void()> task;
+    while(true)
+    {
+        {
+            unique_lock<mutex> lockIt(lock);
+            while(queuedTasks == 0 && !done)
+                cond.wait(lockIt);
+            if(queuedTasks == 0) // done and every task has run
+                return;
+        }
+        if(!takeTask(queueIndex, task)) // another worker took it first
+            continue;
+        {
+            lock_guard<mutex> lockIt(lock);
+            queuedTasks--;
+        }
+        task();
+        task = nullptr;
+    }
+}
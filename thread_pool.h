@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+/** a work stealing thread pool for CPU bound tasks<br/>
+    each worker runs the newest task from its own queue and takes the oldest task from another queue when its own is empty,
+    tasks submitted from a worker go to that worker's queue
+ */
+class ThreadPool final
+{
+    ThreadPool(const ThreadPool &) = delete;
+    const ThreadPool & operator =(const ThreadPool &) = delete;
+private:
+    struct WorkerQueue final
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    vector<shared_ptr<WorkerQueue>> queues;
+    vector<thread> threads;
+    mutex lock;
+    condition_variable cond;
+    size_t queuedTasks = 0; // the tasks in the queues, locked by lock
+    bool done = false;
+    atomic_size_t nextQueue;
+    bool takeTask(size_t queueIndex, function<void()> & task);
+    void run(size_t queueIndex);
+public:
+    /** @param threadCount the number of worker threads, 0 for one per processor
+     */
+    explicit ThreadPool(size_t threadCount = 0);
+    /** runs the tasks that are still queued and then stops the worker threads
+     */
+    ~ThreadPool();
+    /** the process wide pool with one thread per processor
+     */
+    static ThreadPool & get();
+    size_t getThreadCount() const
+    {
+        return threads.size();
+    }
+    void submit(function<void()> task);
+};
+
+#endif // THREAD_POOL_H_INCLUDED